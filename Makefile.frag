@@ -0,0 +1,7 @@
+
+BENCH_ARGS =
+
+bench: all
+	$(PHP_EXECUTABLE) -n -d extension=$(top_builddir)/modules/parallelx.so $(top_srcdir)/bench/bench.php $(BENCH_ARGS)
+
+.PHONY: bench
@@ -0,0 +1,190 @@
+<?php
+/*
+ * parallelx dispatch pipeline benchmark
+ *
+ *   php -d extension=modules/parallelx.so bench/bench.php [options] > bench_output.json
+ *   make bench BENCH_ARGS="--quick"
+ *
+ * options:
+ *   --workers=1,2,4,...     worker counts (default 1,2,4,8,16,32,64)
+ *   --sizes=1,1024,...      payload sizes in bytes (default 1B..8MB)
+ *   --durations=0,1000,...  busy time per task in microseconds (default 0,1000,10000)
+ *   --tasks=N               tasks per run (default 200)
+ *   --quick                 small matrix for smoke testing
+ *
+ * 結果は機械可読なJSONとして標準出力に出す。進捗はSTDERRへ
+ */
+
+declare(strict_types=1);
+
+if (!extension_loaded('parallelx')) {
+    fwrite(STDERR, "parallelx extension is not loaded\n");
+    exit(1);
+}
+
+const PX_MAX_MESSAGE = 8 * 1024 * 1024;
+const PX_WORKER_SCRIPT = __DIR__ . '/../worker/parallelx_worker.php';
+/* 1バッチの結果がそろうまで待つ上限。workerが落ちたりフレームが失われてもmake benchが止まらないように */
+const PX_BATCH_TIMEOUT_S = 60;
+
+$opts = getopt('', ['workers:', 'sizes:', 'durations:', 'tasks:', 'quick']);
+$list = fn(string $key, array $default): array =>
+    isset($opts[$key]) ? array_map('intval', explode(',', (string) $opts[$key])) : $default;
+
+if (isset($opts['quick'])) {
+    $workerCounts = $list('workers', [1, 4]);
+    $sizes = $list('sizes', [1, 65536]);
+    $durations = $list('durations', [0, 1000]);
+    $tasks = (int) ($opts['tasks'] ?? 50);
+} else {
+    $workerCounts = $list('workers', [1, 2, 4, 8, 16, 32, 64]);
+    $sizes = $list('sizes', [1, 1024, 65536, 1048576, 8 * 1048576]);
+    $durations = $list('durations', [0, 1000, 10000]);
+    $tasks = (int) ($opts['tasks'] ?? 200);
+}
+
+function now_us(): float {
+    return hrtime(true) / 1000;
+}
+
+function percentile(array $sorted, float $p): float {
+    if (!$sorted) return 0.0;
+    $idx = (int) ceil($p / 100 * count($sorted)) - 1;
+    return $sorted[max(0, min(count($sorted) - 1, $idx))];
+}
+
+function init_pool(int $workers): void {
+    if (!parallelx_init($workers, PHP_BINARY, PX_WORKER_SCRIPT)) {
+        fwrite(STDERR, "parallelx_init($workers) failed\n");
+        exit(1);
+    }
+}
+
+/* 全タスクをsubmitしてpollで回収し、タスクごとのsubmit→callbackレイテンシを返す */
+function run_batch(string $token, array $argsList): array {
+    $lat = [];
+    $done = 0;
+    $failed = 0;
+    $expected = count($argsList);
+    $start = now_us();
+    foreach ($argsList as $args) {
+        $t0 = now_us();
+        $ok = parallelx_submit_token($token, $args, function($res) use ($t0, &$lat, &$done, &$failed) {
+            $lat[] = now_us() - $t0;
+            if (!$res['success']) $failed++;
+            $done++;
+        });
+        if (!$ok) {
+            $failed++;
+            $expected--;
+        }
+    }
+    $deadline = microtime(true) + PX_BATCH_TIMEOUT_S;
+    while ($done < $expected) {
+        parallelx_poll();
+        if (microtime(true) > $deadline) {
+            fwrite(STDERR, sprintf("timed out after %ds waiting for results (%d of %d reported)\n",
+                PX_BATCH_TIMEOUT_S, $done, $expected));
+            exit(1);
+        }
+        usleep(50);
+    }
+    $wall = now_us() - $start;
+    sort($lat);
+    return [
+        'tasks' => count($argsList),
+        'failed' => $failed,
+        'wall_ms' => round($wall / 1000, 3),
+        'throughput_per_s' => $wall > 0 ? round($done / ($wall / 1e6), 2) : 0,
+        'latency_us' => [
+            'p50' => round(percentile($lat, 50), 1),
+            'p99' => round(percentile($lat, 99), 1),
+            'max' => round($lat ? end($lat) : 0, 1),
+        ],
+    ];
+}
+
+$taskSource = 'function(string $payload, int $busy_us) {
+    $end = hrtime(true) + $busy_us * 1000;
+    while (hrtime(true) < $end) {}
+    return strlen($payload);
+}';
+
+$report = [
+    'meta' => [
+        'php_version' => PHP_VERSION,
+        'parallelx_version' => phpversion('parallelx'),
+        'os' => php_uname('s') . ' ' . php_uname('r'),
+        'cpus' => (int) (trim((string) @shell_exec('nproc')) ?: 0),
+        'timestamp' => date(DATE_ATOM),
+        'tasks_per_run' => $tasks,
+    ],
+    'cold_start' => [],
+    'runs' => [],
+    'restart' => null,
+];
+
+foreach ($workerCounts as $workers) {
+    /* cold start: init + 最初の1タスク往復 */
+    $t0 = now_us();
+    init_pool($workers);
+    $tInit = now_us();
+    $token = parallelx_register($taskSource);
+    run_batch($token, [['', 0]]);
+    $report['cold_start'][] = [
+        'workers' => $workers,
+        'init_ms' => round(($tInit - $t0) / 1000, 3),
+        'first_task_ms' => round((now_us() - $tInit) / 1000, 3),
+    ];
+    /* 全workerを一度温める */
+    run_batch($token, array_fill(0, $workers, ['', 0]));
+
+    foreach ($sizes as $size) {
+        /* JSONのオーバーヘッド分を差し引いてフレーム上限に収める */
+        $bytes = min($size, PX_MAX_MESSAGE - 4096);
+        $payload = str_repeat('x', $bytes);
+        foreach ($durations as $busy) {
+            $n = $bytes >= 1048576 ? min($tasks, 20) : $tasks;
+            fwrite(STDERR, "workers=$workers size=$bytes busy_us=$busy tasks=$n\n");
+            parallelx_stats(true);
+            $r = run_batch($token, array_fill(0, $n, [$payload, $busy]));
+            $s = parallelx_stats();
+            $report['runs'][] = [
+                'workers' => $workers,
+                'payload_bytes' => $bytes,
+                'busy_us' => $busy,
+            ] + $r + [
+                'ext_latency_us' => $s['latency_us'],
+                'codec' => $s['codec'],
+            ];
+        }
+    }
+    parallelx_shutdown();
+}
+
+/* worker restart: workerを落とした直後のタスクが完了するまでの時間 */
+init_pool(1);
+$token = parallelx_register($taskSource);
+$crash = parallelx_register('function() { exit(1); }');
+run_batch($token, [['', 0]]);
+$baseline = run_batch($token, array_fill(0, 20, ['', 0]));
+$restarts = [];
+for ($i = 0; $i < 5; ++$i) {
+    $t0 = now_us();
+    run_batch($crash, [[]]);
+    run_batch($token, [['', 0]]);
+    $restarts[] = now_us() - $t0;
+}
+sort($restarts);
+$report['restart'] = [
+    'samples' => count($restarts),
+    'baseline_roundtrip_us' => $baseline['latency_us']['p50'],
+    'restart_to_next_result_us' => [
+        'p50' => round(percentile($restarts, 50), 1),
+        'max' => round(end($restarts), 1),
+    ],
+    'worker_restarts' => parallelx_stats()['worker_restarts'],
+];
+parallelx_shutdown();
+
+echo json_encode($report, JSON_PRETTY_PRINT | JSON_UNESCAPED_SLASHES), "\n";
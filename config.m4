@@ -2,8 +2,21 @@ PHP_ARG_ENABLE(parallelx, whether to enable parallelx support,
 [  --enable-parallelx   Enable parallelx extension], yes)
 
 if test "$PHP_PARALLELX" != "no"; then
+  PHP_ADD_LIBRARY(pthread, 1, PARALLELX_SHARED_LIBADD)
+
+  AC_CHECK_HEADER([zlib.h], [
+    PHP_CHECK_LIBRARY(z, deflateBound, [
+      PHP_ADD_LIBRARY(z, 1, PARALLELX_SHARED_LIBADD)
+      AC_DEFINE(HAVE_PX_ZLIB, 1, [zlib available for native kernels])
+    ], [
+      AC_MSG_WARN([zlib not found, native:deflate will be unavailable])
+    ])
+  ], [
+    AC_MSG_WARN([zlib.h not found, native:deflate will be unavailable])
+  ])
   PHP_SUBST(PARALLELX_SHARED_LIBADD)
   AC_DEFINE(HAVE_PARALLELX, 1, [Have parallelx])
   AC_MSG_NOTICE([building parallelx])
-  PHP_NEW_EXTENSION(parallelx, src/parallelx.c src/px_json.c src/px_queue.c src/px_registry.c src/px_worker.c, $ext_shared)
+  PHP_NEW_EXTENSION(parallelx, src/parallelx.c src/px_batch.c src/px_closure.c src/px_fork.c src/px_hedge.c src/px_json.c src/px_memo.c src/px_native.c src/px_owner.c src/px_queue.c src/px_registry.c src/px_remote.c src/px_shm.c src/px_stats.c src/px_thread.c src/px_trace.c src/px_usage.c src/px_worker.c, $ext_shared)
+  PHP_ADD_MAKEFILE_FRAGMENT
 fi
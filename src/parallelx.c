@@ -7,10 +7,12 @@
 #include "php.h"
 #include "php_ini.h"
 #include "ext/standard/info.h"
+#include "zend_closures.h"
 
 #include "parallelx.h"
 #include "px_internal.h"
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -22,18 +24,19 @@
 px_worker *workers = NULL;
 int px_worker_count = 0;
 int px_initialized = 0;
+px_backend px_active_backend = PX_BACKEND_PROCESS;
 char worker_script_path[PATH_MAX] = {0};
 char php_cli_path[PATH_MAX] = "php";
 unsigned long next_task_id = 1;
+int px_generation = 0;
 
-pending_node *pending_head = NULL;
-pending_node *pending_tail = NULL;
 running_node *running_head = NULL;
 closure_entry *closure_head = NULL;
 
 /* -------------------- PHP API  -------------------- */
 
-/* parallelx_init(workers, php_cli = null, worker_script = null, autoload = null) */
+/* parallelx_init(workers, php_cli = null, worker_script = null, autoload = null, backend = "process")
+ * backend: "process" (php CLIの子プロセス) | "thread" (ZTSビルドのみ。プロセス内スレッド) */
 PHP_FUNCTION(parallelx_init) {
     zend_long workers_z = 0;
     char *php_bin = NULL;
@@ -42,9 +45,23 @@ PHP_FUNCTION(parallelx_init) {
     size_t user_script_len = 0;
     char *autoload = NULL;
     size_t autoload_len = 0;
+    char *backend = NULL;
+    size_t backend_len = 0;
 
-    if (zend_parse_parameters(ZEND_NUM_ARGS(), "l|s!s!s!", &workers_z, &php_bin, &php_bin_len, &user_script,
-                              &user_script_len, &autoload, &autoload_len) == FAILURE) {
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "l|s!s!s!s!", &workers_z, &php_bin, &php_bin_len, &user_script,
+                              &user_script_len, &autoload, &autoload_len, &backend, &backend_len) == FAILURE) {
+        RETURN_FALSE;
+    }
+    px_backend kind = PX_BACKEND_PROCESS;
+    if (backend && strcmp(backend, "thread") == 0) {
+#ifdef ZTS
+        kind = PX_BACKEND_THREAD;
+#else
+        php_error_docref(NULL, E_WARNING, "parallelx: thread backend requires a ZTS build of PHP");
+        RETURN_FALSE;
+#endif
+    } else if (backend && strcmp(backend, "process") != 0) {
+        php_error_docref(NULL, E_WARNING, "parallelx: unknown backend '%s'", backend);
         RETURN_FALSE;
     }
     if (workers_z <= 0) workers_z = 2;
@@ -64,16 +81,26 @@ PHP_FUNCTION(parallelx_init) {
         setenv(ENV_AUTLOAD, autoload, 1);
     }
 
-    if (px_create_worker_script_if_missing(user_script ? user_script : NULL) != 0) {
-        php_error_docref(NULL, E_WARNING, "parallelx: failed to create/find worker script");
-        RETURN_FALSE;
-    }
+    if (kind == PX_BACKEND_THREAD) {
+        if (px_spawn_threads((int) workers_z) != 0) {
+            php_error_docref(NULL, E_WARNING, "parallelx: spawn_threads failed");
+            RETURN_FALSE;
+        }
+    } else {
+        if (px_create_worker_script_if_missing(user_script ? user_script : NULL) != 0) {
+            php_error_docref(NULL, E_WARNING, "parallelx: failed to create/find worker script");
+            RETURN_FALSE;
+        }
 
-    if (px_spawn_workers((int) workers_z) != 0) {
-        php_error_docref(NULL, E_WARNING, "parallelx: spawn_workers failed");
-        RETURN_FALSE;
+        if (px_spawn_workers((int) workers_z) != 0) {
+            php_error_docref(NULL, E_WARNING, "parallelx: spawn_workers failed");
+            RETURN_FALSE;
+        }
     }
+    px_active_backend = kind;
+    px_generation = 0;
 
+    px_stats_reset();
     px_initialized = 1;
     RETURN_TRUE;
 }
@@ -100,27 +127,102 @@ PHP_FUNCTION(parallelx_register) {
     RETVAL_STRING(token);
 }
 
-/* parallelx_submit_desc(descriptor_array, callable) */
+/* parallelx_register_closure(Closure) -> token
+ * クロージャのソース範囲と use / static 変数を拡張内で取り出して登録する。
+ * tokenは内容のハッシュ("px_clo_<hex>")なので、同じクロージャを何度登録しても同じtokenが返る */
+PHP_FUNCTION(parallelx_register_closure) {
+    zval *closure = NULL;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "O", &closure, zend_ce_closure) == FAILURE) {
+        RETURN_FALSE;
+    }
+    if (!px_initialized) {
+        php_error_docref(NULL, E_WARNING, "parallelx: not initialized");
+        RETURN_FALSE;
+    }
+    const char *err = NULL;
+    char *token = px_closure_register(closure, &err);
+    if (!token) {
+        php_error_docref(NULL, E_WARNING, "parallelx_register_closure: %s", err ? err : "failed");
+        RETURN_FALSE;
+    }
+    RETVAL_STRING(token);
+}
+
+/* submitのoptions配列: 'owner' => string, 'hedge' => int ms | true (tokenのp95) */
+static int parse_task_options(zval *options, closure_entry *e, px_task_opts *opts, const char *fname) {
+    opts->owner = NULL;
+    opts->exec_hist = NULL;
+    opts->usage = e ? &e->usage : NULL;
+    opts->hedge_us = 0;
+    if (px_owner_from_options(options, &opts->owner) != 0) {
+        php_error_docref(NULL, E_WARNING, "%s: owner must be a non-empty string", fname);
+        return -1;
+    }
+    if (e) {
+        if (!e->exec_hist) e->exec_hist = (px_hist *) calloc(1, sizeof(px_hist));
+        opts->exec_hist = e->exec_hist;
+    }
+    zval *zh = options ? zend_hash_str_find(Z_ARRVAL_P(options), "hedge", sizeof("hedge") - 1) : NULL;
+    if (!zh || Z_TYPE_P(zh) == IS_NULL || Z_TYPE_P(zh) == IS_FALSE) return 0;
+    if (Z_TYPE_P(zh) == IS_TRUE) {
+        opts->hedge_us = -1;
+    } else if (Z_TYPE_P(zh) == IS_LONG && Z_LVAL_P(zh) > 0) {
+        opts->hedge_us = (int64_t) Z_LVAL_P(zh) * 1000;
+    } else {
+        php_error_docref(NULL, E_WARNING, "%s: hedge must be a positive number of milliseconds or true", fname);
+        return -1;
+    }
+    return 0;
+}
+
+/* callbackを省略したsubmitは結果を parallelx_poll_results() で受け取るのでtask idを返す */
+#define PX_RETURN_SUBMITTED(tid, callback) \
+    do { \
+        if (callback) RETURN_TRUE; \
+        RETURN_LONG((zend_long) (tid)); \
+    } while (0)
+
+/* parallelx_submit_desc(descriptor_array, ?callable = null, options = []) -> true | int task_id
+ * options: 'owner' => string (公平キューのowner。省略時は "default"),
+ *          'hedge' => int ms | true (閾値を過ぎたら空きworkerへ同じタスクを投げる) */
 PHP_FUNCTION(parallelx_submit_desc) {
     zval *desc = NULL;
     zval *callback = NULL;
-    if (zend_parse_parameters(ZEND_NUM_ARGS(), "zz", &desc, &callback) == FAILURE) {
+    zval *options = NULL;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "z|z!a", &desc, &callback, &options) == FAILURE) {
         RETURN_FALSE;
     }
     if (Z_TYPE_P(desc) != IS_ARRAY) {
         php_error_docref(NULL, E_WARNING, "parallelx_submit_desc: descriptor must be array");
         RETURN_FALSE;
     }
-    if (!zend_is_callable(callback, 0, NULL)) {
-        php_error_docref(NULL, E_WARNING, "parallelx_submit_desc: second param must be callable");
+    if (callback && !zend_is_callable(callback, 0, NULL)) {
+        php_error_docref(NULL, E_WARNING, "parallelx_submit_desc: second param must be callable or null");
         RETURN_FALSE;
     }
     if (!px_initialized) {
         php_error_docref(NULL, E_WARNING, "parallelx_submit_desc: not initialized");
         RETURN_FALSE;
     }
+    px_task_opts opts;
+    if (parse_task_options(options, NULL, &opts, "parallelx_submit_desc") != 0) {
+        RETURN_FALSE;
+    }
 
     unsigned long tid = next_task_id++;
+    zval target;
+    px_batch_target(NULL, &target);
+    zval *cb = callback ? callback : &target;
+
+    /* native:* はworkerを通さず拡張内のスレッドプールで実行する */
+    zval *ztype = zend_hash_str_find(Z_ARRVAL_P(desc), "type", sizeof("type") - 1);
+    if (ztype && Z_TYPE_P(ztype) == IS_STRING && px_native_is_native_type(Z_STRVAL_P(ztype))) {
+        if (px_native_submit(tid, Z_STRVAL_P(ztype), desc, cb) != SUCCESS) {
+            RETURN_FALSE;
+        }
+        px_stats.tasks_submitted++;
+        PX_RETURN_SUBMITTED(tid, callback);
+    }
 
     char *json_payload = NULL;
     size_t payload_len = 0;
@@ -129,26 +231,29 @@ PHP_FUNCTION(parallelx_submit_desc) {
         RETURN_FALSE;
     }
 
-    if (px_enqueue_payload(tid, json_payload, payload_len, callback) != SUCCESS) {
+    if (px_enqueue_payload(tid, json_payload, payload_len, cb, &opts) != SUCCESS) {
         efree(json_payload);
         php_error_docref(NULL, E_WARNING, "parallelx_submit_desc: enqueue failed");
         RETURN_FALSE;
     }
+    px_stats.tasks_submitted++;
 
-    RETURN_TRUE;
+    PX_RETURN_SUBMITTED(tid, callback);
 }
 
-/* parallelx_submit_token(token, args_array, callable) */
+/* parallelx_submit_token(token, args_array, ?callable = null, options = []) -> true | int task_id
+ * callbackを省略すると、tokenにbatch callbackがあればそちらへ、無ければ parallelx_poll_results() へ */
 PHP_FUNCTION(parallelx_submit_token) {
     char *token = NULL;
     size_t token_len = 0;
     zval *args = NULL;
     zval *callback = NULL;
-    if (zend_parse_parameters(ZEND_NUM_ARGS(), "szz", &token, &token_len, &args, &callback) == FAILURE) {
+    zval *options = NULL;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "sz|z!a", &token, &token_len, &args, &callback, &options) == FAILURE) {
         RETURN_FALSE;
     }
-    if (!zend_is_callable(callback, 0, NULL)) {
-        php_error_docref(NULL, E_WARNING, "parallelx_submit_token: third param must be callable");
+    if (callback && !zend_is_callable(callback, 0, NULL)) {
+        php_error_docref(NULL, E_WARNING, "parallelx_submit_token: third param must be callable or null");
         RETURN_FALSE;
     }
     if (Z_TYPE_P(args) != IS_ARRAY) {
@@ -164,8 +269,28 @@ PHP_FUNCTION(parallelx_submit_token) {
         php_error_docref(NULL, E_WARNING, "parallelx_submit_token: token not found");
         RETURN_FALSE;
     }
+    px_task_opts opts;
+    if (parse_task_options(options, e, &opts, "parallelx_submit_token") != 0) {
+        RETURN_FALSE;
+    }
 
     unsigned long tid = next_task_id++;
+    zval target;
+    px_batch_target(e, &target);
+    zval *cb = callback ? callback : &target;
+
+    if (e->memo) {
+        smart_str key = {0};
+        int st = PX_MEMO_MISS_UNTRACKED;
+        if (php_json_encode(&key, args, 0) == SUCCESS && key.s) {
+            st = px_memo_lookup(e->memo, e->token, ZSTR_VAL(key.s), ZSTR_LEN(key.s), tid, cb);
+        }
+        smart_str_free(&key);
+        if (st == PX_MEMO_HIT || st == PX_MEMO_COALESCED) {
+            px_stats.tasks_submitted++;
+            PX_RETURN_SUBMITTED(tid, callback);
+        }
+    }
 
     zval desc;
     array_init(&desc);
@@ -180,34 +305,128 @@ PHP_FUNCTION(parallelx_submit_token) {
     size_t payload_len = 0;
     if (px_encode_descriptor_with_task(&desc, tid, &json_payload, &payload_len) != SUCCESS) {
         zval_ptr_dtor(&desc);
+        px_memo_fail(tid, "json_encode failed");
         php_error_docref(NULL, E_WARNING, "parallelx_submit_token: json_encode failed");
         RETURN_FALSE;
     }
 
-    if (px_enqueue_payload(tid, json_payload, payload_len, callback) != SUCCESS) {
+    if (px_enqueue_payload(tid, json_payload, payload_len, cb, &opts) != SUCCESS) {
         efree(json_payload);
         zval_ptr_dtor(&desc);
+        px_memo_fail(tid, "enqueue failed");
         php_error_docref(NULL, E_WARNING, "parallelx_submit_token: enqueue failed");
         RETURN_FALSE;
     }
 
+    px_stats.tasks_submitted++;
+
     zval_ptr_dtor(&desc);
-    RETURN_TRUE;
+    PX_RETURN_SUBMITTED(tid, callback);
 }
 
-/* parallelx_poll() - PMMPのメインスレッド側でポール(1tickごとの呼出しが理想) */
-PHP_FUNCTION(parallelx_poll) {
-    if (zend_parse_parameters_none() == FAILURE) RETURN_FALSE;
-    if (!px_initialized) RETURN_FALSE;
+/* parallelx_submit_fork(callable task, array args, ?callable onComplete = null) -> true | int task_id
+ * メインプロセスをforkしてtaskを子で直接実行する(Linuxのみ)。引数も状態もcopy-on-writeで渡る */
+PHP_FUNCTION(parallelx_submit_fork) {
+    zval *task = NULL;
+    zval *args = NULL;
+    zval *callback = NULL;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "za|z!", &task, &args, &callback) == FAILURE) {
+        RETURN_FALSE;
+    }
+#ifndef __linux__
+    php_error_docref(NULL, E_WARNING, "parallelx_submit_fork: fork mode is only supported on Linux");
+    RETURN_FALSE;
+#else
+    if (!zend_is_callable(task, 0, NULL)) {
+        php_error_docref(NULL, E_WARNING, "parallelx_submit_fork: first param must be callable");
+        RETURN_FALSE;
+    }
+    if (callback && !zend_is_callable(callback, 0, NULL)) {
+        php_error_docref(NULL, E_WARNING, "parallelx_submit_fork: third param must be callable or null");
+        RETURN_FALSE;
+    }
+    if (!px_initialized) {
+        php_error_docref(NULL, E_WARNING, "parallelx_submit_fork: not initialized");
+        RETURN_FALSE;
+    }
+    /* 他のスレッドが握っているTSRM/アロケータのロックを子が引き継いでしまう */
+    if (px_active_backend == PX_BACKEND_THREAD) {
+        php_error_docref(NULL, E_WARNING, "parallelx_submit_fork: fork mode cannot be used with the thread backend");
+        RETURN_FALSE;
+    }
+    if (px_fork_active() >= px_fork_max) {
+        php_error_docref(NULL, E_WARNING, "parallelx_submit_fork: too many concurrent forks (limit %d)", px_fork_max);
+        RETURN_FALSE;
+    }
+
+    unsigned long tid = next_task_id++;
+    zval target;
+    px_batch_target(NULL, &target);
+    if (px_fork_submit(tid, task, args, callback ? callback : &target) != SUCCESS) {
+        php_error_docref(NULL, E_WARNING, "parallelx_submit_fork: fork failed: %s", strerror(errno));
+        RETURN_FALSE;
+    }
+    px_stats.tasks_submitted++;
+    PX_RETURN_SUBMITTED(tid, callback);
+#endif
+}
 
+/* parallelx_fork_limit(int max) -> int 以前の上限 */
+PHP_FUNCTION(parallelx_fork_limit) {
+    zend_long max = 0;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "l", &max) == FAILURE) {
+        RETURN_FALSE;
+    }
+    if (max < 1 || max > PX_FORK_MAX) {
+        php_error_docref(NULL, E_WARNING, "parallelx_fork_limit: limit must be between 1 and %d", PX_FORK_MAX);
+        RETURN_FALSE;
+    }
+    int prev = px_fork_max;
+    px_fork_max = (int) max;
+    RETURN_LONG(prev);
+}
+
+/* workerが結果フレームに載せた t_start / t_end (microtime) と受信・decodeを記録 */
+static void trace_result(zval *result, unsigned long tid, int lane, uint64_t recv_ns) {
+    zval *zs = zend_hash_str_find(Z_ARRVAL_P(result), "t_start", sizeof("t_start") - 1);
+    zval *ze = zend_hash_str_find(Z_ARRVAL_P(result), "t_end", sizeof("t_end") - 1);
+    if (zs && ze && Z_TYPE_P(zs) == IS_DOUBLE && Z_TYPE_P(ze) == IS_DOUBLE) {
+        uint64_t start_ns = px_trace_from_wall(Z_DVAL_P(zs));
+        uint64_t end_ns = px_trace_from_wall(Z_DVAL_P(ze));
+        if (end_ns >= start_ns) px_trace_record(PX_TRACE_EXECUTE, tid, lane, start_ns, end_ns - start_ns);
+    }
+    px_trace_record(PX_TRACE_RECEIVE, tid, -1, recv_ns, 0);
+    px_trace_record(PX_TRACE_DECODE, tid, -1, recv_ns, px_now_ns() - recv_ns);
+}
+
+/* workerからの結果を受け取ってcallbackへ配り、空いたworkerへ次のタスクを送る */
+static void poll_once(void) {
     for (int i = 0; i < px_worker_count; ++i) {
         px_worker *w = &workers[i];
 
+        if (w->retired) continue;
+        /* 旧世代は手が空いたら退役 */
+        if (w->draining && !w->busy) {
+            px_worker_retire(w);
+            continue;
+        }
+        /* 再接続中のremote slotはhelloが届くまで進めるだけ */
+        if (w->connecting) {
+            if (px_remote_poll_connect(w) > 0) {
+                px_stats.worker_restarts++;
+                px_stats.workers[i].restarts++;
+                px_assign_pending(w);
+            }
+            continue;
+        }
+        /* 再接続待ちのremote slot */
+        if (w->dead && w->remote && w->retry_ns > px_now_ns()) continue;
+
+        px_flush_worker(w);
         px_read_from_worker(w);
         if (w->dead) {
-            if (w->busy && w->current_task_id) {
-                px_fail_task(w->current_task_id, "worker died");
-            }
+            /* restart側で二重に失敗させないよう先に手放す */
+            px_worker_abandon(w, "worker died");
             px_restart_worker(i);
             continue;
         }
@@ -218,18 +437,19 @@ PHP_FUNCTION(parallelx_poll) {
             int ex = px_try_extract(w, &payload, &payload_len);
             if (ex == 0) break;
             if (ex < 0) {
-                if (w->busy && w->current_task_id) {
-                    px_fail_task(w->current_task_id, "protocol error");
-                }
+                px_stats.protocol_errors++;
+                px_worker_abandon(w, "protocol error");
                 px_restart_worker(i);
                 break;
             }
 
+            uint64_t recv_ns = px_now_ns();
             zval result;
             if (px_decode_worker_json(payload, payload_len, &result) != SUCCESS) {
+                px_stats.decode_errors++;
                 php_error_docref(NULL, E_WARNING, "parallelx: json_decode failed");
-                w->busy = 0;
-                w->current_task_id = 0;
+                px_memo_fail(w->current_task_id, "json_decode failed");
+                px_worker_release(w);
                 px_assign_pending(w);
                 free(payload);
                 continue;
@@ -242,24 +462,38 @@ PHP_FUNCTION(parallelx_poll) {
                     if (Z_TYPE_P(ztid) == IS_LONG) tid = (unsigned long) Z_LVAL_P(ztid);
                     else if (Z_TYPE_P(ztid) == IS_STRING) tid = strtoul(Z_STRVAL_P(ztid), NULL, 10);
                 }
-                zval *cb = px_running_pop(tid);
-                if (cb) {
-                    px_invoke_callback(cb, &result);
-                    zval_ptr_dtor(cb);
-                    efree(cb);
-                } else {
-                    php_error_docref(NULL, E_NOTICE, "parallelx: callback not found for task_id %lu", tid);
+                if (px_trace_enabled) trace_result(&result, tid, i, recv_ns);
+                /* hedgeで先に結果を返したタスクのもう一方は捨てる */
+                if (!px_hedge_on_result(tid, w)) {
+                    zval *cb = px_running_pop(tid);
+                    if (cb) {
+                        if (w->current_task_id == tid && w->owner) w->owner->completed++;
+                        uint64_t cb_ns = px_now_ns();
+                        px_invoke_callback(cb, &result);
+                        uint64_t cb_end_ns = px_now_ns();
+                        px_hist_record(&px_stats.callback, (cb_end_ns - cb_ns) / 1000);
+                        px_trace_record(PX_TRACE_CALLBACK, tid, -1, cb_ns, cb_end_ns - cb_ns);
+                        px_stats.tasks_completed++;
+                        zval_ptr_dtor(cb);
+                        efree(cb);
+                    } else {
+                        px_stats.callback_not_found++;
+                        php_error_docref(NULL, E_NOTICE, "parallelx: callback not found for task_id %lu", tid);
+                    }
+                    px_memo_complete(tid, payload, payload_len, &result);
                 }
 
                 if (w->current_task_id == tid) {
-                    w->busy = 0;
-                    w->current_task_id = 0;
+                    px_reload_confirm(w);
+                    px_usage_record(w, &result);
+                    px_stats_on_complete(w, recv_ns);
+                    px_worker_release(w);
                     px_assign_pending(w);
                 }
             } else {
                 php_error_docref(NULL, E_WARNING, "parallelx: worker returned non-array JSON");
-                w->busy = 0;
-                w->current_task_id = 0;
+                px_memo_fail(w->current_task_id, "worker returned non-array JSON");
+                px_worker_release(w);
                 px_assign_pending(w);
             }
 
@@ -268,7 +502,90 @@ PHP_FUNCTION(parallelx_poll) {
         }
     }
 
+    px_worker_reap(0);
+    px_fork_poll();
+    px_native_drain();
+    px_memo_drain();
     px_dispatch_pending_to_idle();
+    px_hedge_launch_due();
+    px_batch_flush();
+}
+
+/* parallelx_poll() - PMMPのメインスレッド側でポール(1tickごとの呼出しが理想) */
+PHP_FUNCTION(parallelx_poll) {
+    if (zend_parse_parameters_none() == FAILURE) RETURN_FALSE;
+    if (!px_initialized) RETURN_FALSE;
+    poll_once();
+    RETURN_TRUE;
+}
+
+/* parallelx_poll_results(int max = 0) -> array task_id => result
+ * pollしたうえで、callbackなしでsubmitしたタスクの結果を最大max件(0なら全部)取り出す。
+ * 残りは次の呼び出しで返る */
+PHP_FUNCTION(parallelx_poll_results) {
+    zend_long max = 0;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "|l", &max) == FAILURE) {
+        RETURN_FALSE;
+    }
+    if (!px_initialized) RETURN_FALSE;
+    if (max < 0) {
+        php_error_docref(NULL, E_WARNING, "parallelx_poll_results: max must be >= 0");
+        RETURN_FALSE;
+    }
+    poll_once();
+    px_batch_take(max, return_value);
+}
+
+/* parallelx_token_usage(?string token = null, bool reset = false) -> array
+ * workerが申告したタスクごとの wall / CPU時間 / ピークメモリをtokenごとに集計したもの。
+ * tokenを省略すると実行済みの全token(token => usage) */
+PHP_FUNCTION(parallelx_token_usage) {
+    char *token = NULL;
+    size_t token_len = 0;
+    zend_bool reset = 0;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "|s!b", &token, &token_len, &reset) == FAILURE) {
+        RETURN_FALSE;
+    }
+    if (token) {
+        closure_entry *e = px_registry_find(token);
+        if (!e) {
+            php_error_docref(NULL, E_WARNING, "parallelx_token_usage: token not found");
+            RETURN_FALSE;
+        }
+        px_usage_to_array(&e->usage, return_value);
+        if (reset) memset(&e->usage, 0, sizeof(e->usage));
+        return;
+    }
+    array_init(return_value);
+    for (closure_entry *e = closure_head; e; e = e->next) {
+        if (e->usage.tasks == 0) continue;
+        zval u;
+        px_usage_to_array(&e->usage, &u);
+        add_assoc_zval(return_value, e->token, &u);
+        if (reset) memset(&e->usage, 0, sizeof(e->usage));
+    }
+}
+
+/* parallelx_set_batch_callback(token, ?callable) -> bool
+ * callbackなしでsubmitされたこのtokenのタスクの結果を、pollごとに task_id => result の配列で1回だけ渡す。
+ * nullで解除(溜まっている分は parallelx_poll_results() へ) */
+PHP_FUNCTION(parallelx_set_batch_callback) {
+    char *token = NULL;
+    size_t token_len = 0;
+    zval *callback = NULL;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "sz!", &token, &token_len, &callback) == FAILURE) {
+        RETURN_FALSE;
+    }
+    if (callback && !zend_is_callable(callback, 0, NULL)) {
+        php_error_docref(NULL, E_WARNING, "parallelx_set_batch_callback: second param must be callable or null");
+        RETURN_FALSE;
+    }
+    closure_entry *e = px_registry_find(token);
+    if (!e) {
+        php_error_docref(NULL, E_WARNING, "parallelx_set_batch_callback: token not found");
+        RETURN_FALSE;
+    }
+    px_batch_set_callback(e, callback);
     RETURN_TRUE;
 }
 
@@ -277,6 +594,7 @@ PHP_FUNCTION(parallelx_shutdown) {
     if (zend_parse_parameters_none() == FAILURE) RETURN_FALSE;
     if (!px_initialized) RETURN_FALSE;
 
+    if (px_active_backend == PX_BACKEND_THREAD) px_thread_shutdown_all();
     for (int i = 0; i < px_worker_count; ++i) {
         if (workers[i].pid > 0) kill(workers[i].pid, SIGTERM);
     }
@@ -285,26 +603,418 @@ PHP_FUNCTION(parallelx_shutdown) {
         if (workers[i].to_child) close(workers[i].to_child);
         if (workers[i].from_child) close(workers[i].from_child);
         if (workers[i].recv_buf) free(workers[i].recv_buf);
+        if (workers[i].send_buf) free(workers[i].send_buf);
+        px_worker_release(&workers[i]);
     }
     free(workers);
     workers = NULL;
     px_worker_count = 0;
     px_initialized = 0;
 
+    px_native_shutdown();
+    px_fork_shutdown();
+
+    px_hedge_free_all();
+    px_memo_free_all();
     px_queue_free_all();
+    px_batch_free_all();
+    px_owner_free_all();
+    px_remote_free_all();
+    px_reload_free();
+    px_worker_reap(1);
 
     px_registry_free_all();
+    px_closure_free_all();
+
+    px_shm_free_all();
 
     unsetenv(ENV_AUTLOAD);
 
     RETURN_TRUE;
 }
 
+/* parallelx_stats(reset = false) -> array */
+PHP_FUNCTION(parallelx_stats) {
+    zend_bool reset = 0;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "|b", &reset) == FAILURE) {
+        RETURN_FALSE;
+    }
+    px_stats_to_array(return_value);
+    if (reset) px_stats_reset();
+}
+
+/* parallelx_reload(options = []) -> bool
+ * options: 'workers' => int, 'php_cli' => string, 'worker_script' => string, 'autoload' => string
+ * 新しい設定でworkerを起動して以降のdispatchをそちらへ移す。旧workerは新しいworkerが最初の結果を
+ * 返すまで動き続け、その後は実行中のタスクを終えてから止まる。それより前に新しいworkerが落ちたら旧設定に戻る */
+PHP_FUNCTION(parallelx_reload) {
+    zval *options = NULL;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "|a", &options) == FAILURE) {
+        RETURN_FALSE;
+    }
+    if (!px_initialized) {
+        php_error_docref(NULL, E_WARNING, "parallelx_reload: not initialized");
+        RETURN_FALSE;
+    }
+    if (px_active_backend != PX_BACKEND_PROCESS) {
+        php_error_docref(NULL, E_WARNING, "parallelx_reload: only the process backend can be reloaded");
+        RETURN_FALSE;
+    }
+    if (px_reload_pending()) {
+        php_error_docref(NULL, E_WARNING, "parallelx_reload: the previous reload has not switched over yet");
+        RETURN_FALSE;
+    }
+
+    int current = 0;
+    for (int i = 0; i < px_worker_count; ++i) {
+        px_worker *w = &workers[i];
+        if (!w->retired && !w->draining && !w->remote) current++;
+    }
+    zend_long count = current > 0 ? current : 2;
+    const char *php_bin = NULL, *script = NULL, *autoload = NULL;
+    if (options) {
+        zval *z;
+        if ((z = zend_hash_str_find(Z_ARRVAL_P(options), "workers", sizeof("workers") - 1)) && Z_TYPE_P(z) == IS_LONG) {
+            count = Z_LVAL_P(z);
+        }
+        if ((z = zend_hash_str_find(Z_ARRVAL_P(options), "php_cli", sizeof("php_cli") - 1)) && Z_TYPE_P(z) == IS_STRING) {
+            php_bin = Z_STRVAL_P(z);
+        }
+        if ((z = zend_hash_str_find(Z_ARRVAL_P(options), "worker_script", sizeof("worker_script") - 1)) &&
+            Z_TYPE_P(z) == IS_STRING) {
+            script = Z_STRVAL_P(z);
+        }
+        if ((z = zend_hash_str_find(Z_ARRVAL_P(options), "autoload", sizeof("autoload") - 1)) && Z_TYPE_P(z) == IS_STRING) {
+            autoload = Z_STRVAL_P(z);
+        }
+    }
+    if (count <= 0 || count > PARALLELX_MAX_WORKERS) {
+        php_error_docref(NULL, E_WARNING, "parallelx_reload: workers must be between 1 and %d", PARALLELX_MAX_WORKERS);
+        RETURN_FALSE;
+    }
+    if (count > px_worker_free_slots()) {
+        php_error_docref(NULL, E_WARNING, "parallelx_reload: not enough free worker slots (%d) while the old generation drains",
+                         px_worker_free_slots());
+        RETURN_FALSE;
+    }
+    if (script && access(script, R_OK) != 0) {
+        php_error_docref(NULL, E_WARNING, "parallelx_reload: worker script '%s' is not readable", script);
+        RETURN_FALSE;
+    }
+    /* execlはPATHを引かないので、そのままのパスで実行できるかを見る */
+    const char *cli = (php_bin && *php_bin) ? php_bin : php_cli_path;
+    if (access(cli, X_OK) != 0) {
+        php_error_docref(NULL, E_WARNING, "parallelx_reload: php_cli '%s' is not executable", cli);
+        RETURN_FALSE;
+    }
+
+    /* 失敗したら元に戻せるよう旧設定を控えておく */
+    char old_cli[PATH_MAX], old_script[PATH_MAX];
+    memcpy(old_cli, php_cli_path, sizeof(old_cli));
+    memcpy(old_script, worker_script_path, sizeof(old_script));
+    const char *env = getenv(ENV_AUTLOAD);
+    char *old_autoload = env ? px_strdup(env) : NULL;
+
+    if (php_bin && *php_bin) {
+        strncpy(php_cli_path, php_bin, sizeof(php_cli_path) - 1);
+        php_cli_path[sizeof(php_cli_path) - 1] = '\0';
+    }
+    if (script) px_create_worker_script_if_missing(script);
+    if (autoload) {
+        if (*autoload) setenv(ENV_AUTLOAD, autoload, 1);
+        else unsetenv(ENV_AUTLOAD);
+    }
+
+    px_generation++;
+    int spawned = px_spawn_generation((int) count);
+    if (spawned == 0) {
+        px_generation--;
+        memcpy(php_cli_path, old_cli, sizeof(old_cli));
+        memcpy(worker_script_path, old_script, sizeof(old_script));
+        if (old_autoload) setenv(ENV_AUTLOAD, old_autoload, 1);
+        else unsetenv(ENV_AUTLOAD);
+        free(old_autoload);
+        php_error_docref(NULL, E_WARNING, "parallelx_reload: failed to start new workers");
+        RETURN_FALSE;
+    }
+    if (spawned < count) {
+        php_error_docref(NULL, E_NOTICE, "parallelx_reload: started %d of " ZEND_LONG_FMT " workers", spawned, count);
+    }
+
+    /* 旧世代の退役は新しい世代が1往復してから(px_reload_confirm) */
+    px_reload_begin(old_cli, old_script, old_autoload);
+    px_dispatch_pending_to_idle();
+    RETURN_TRUE;
+}
+
+/* parallelx_add_remote(address, slots = 0, secret = '') -> int 追加したslot数
+ * address: unix:///path/to.sock | tcp://host:port (worker/parallelx_daemon.php)。slots 0 はdaemonの申告どおり
+ * secret: daemonの PARALLELX_SECRET / --secret-file と同じ値 */
+PHP_FUNCTION(parallelx_add_remote) {
+    char *address = NULL;
+    size_t address_len = 0;
+    zend_long slots = 0;
+    char *secret = "";
+    size_t secret_len = 0;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "p|lp", &address, &address_len, &slots, &secret, &secret_len) == FAILURE) {
+        RETURN_FALSE;
+    }
+    if (!px_initialized) {
+        php_error_docref(NULL, E_WARNING, "parallelx_add_remote: not initialized");
+        RETURN_FALSE;
+    }
+    if (slots < 0) {
+        php_error_docref(NULL, E_WARNING, "parallelx_add_remote: slots must not be negative");
+        RETURN_FALSE;
+    }
+    char err[256];
+    int added = px_remote_add(address, (int) slots, secret, err, sizeof(err));
+    if (added < 0) {
+        php_error_docref(NULL, E_WARNING, "parallelx_add_remote: %s", err);
+        RETURN_FALSE;
+    }
+    px_dispatch_pending_to_idle();
+    RETURN_LONG(added);
+}
+
+/* parallelx_owner_config(owner, weight = 1, max_inflight = 0) - max_inflight 0 は無制限 */
+PHP_FUNCTION(parallelx_owner_config) {
+    char *name = NULL;
+    size_t name_len = 0;
+    zend_long weight = 1;
+    zend_long max_inflight = 0;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "s|ll", &name, &name_len, &weight, &max_inflight) == FAILURE) {
+        RETURN_FALSE;
+    }
+    if (name_len == 0) {
+        php_error_docref(NULL, E_WARNING, "parallelx_owner_config: owner must not be empty");
+        RETURN_FALSE;
+    }
+    if (weight < 1 || weight > PX_OWNER_MAX_WEIGHT) {
+        php_error_docref(NULL, E_WARNING, "parallelx_owner_config: weight must be between 1 and %d", PX_OWNER_MAX_WEIGHT);
+        RETURN_FALSE;
+    }
+    if (max_inflight < 0) {
+        php_error_docref(NULL, E_WARNING, "parallelx_owner_config: max_inflight must not be negative");
+        RETURN_FALSE;
+    }
+    px_owner *o = px_owner_get(name);
+    if (!o) {
+        php_error_docref(NULL, E_WARNING, "parallelx_owner_config: out of memory");
+        RETURN_FALSE;
+    }
+    o->weight = (int) weight;
+    o->max_inflight = (int) max_inflight;
+    /* 上限が上がった分をすぐに流す */
+    if (px_initialized) px_dispatch_pending_to_idle();
+    RETURN_TRUE;
+}
+
+/* parallelx_memoize(token, ttl_ms, max_bytes = 4MB) - ttl_ms == 0 は重複排除のみ、負数で無効化 */
+PHP_FUNCTION(parallelx_memoize) {
+    char *token = NULL;
+    size_t token_len = 0;
+    zend_long ttl_ms = 0;
+    zend_long max_bytes = PX_MEMO_DEFAULT_BYTES;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "sl|l", &token, &token_len, &ttl_ms, &max_bytes) == FAILURE) {
+        RETURN_FALSE;
+    }
+    if (max_bytes < 0) {
+        php_error_docref(NULL, E_WARNING, "parallelx_memoize: max_bytes must not be negative");
+        RETURN_FALSE;
+    }
+    closure_entry *e = px_registry_find(token);
+    if (!e) {
+        php_error_docref(NULL, E_WARNING, "parallelx_memoize: token not found");
+        RETURN_FALSE;
+    }
+    if (!e->memo) {
+        if (ttl_ms < 0) RETURN_TRUE;
+        e->memo = px_memo_create();
+        if (!e->memo) {
+            php_error_docref(NULL, E_WARNING, "parallelx_memoize: out of memory");
+            RETURN_FALSE;
+        }
+    }
+    px_memo_configure(e->memo, ttl_ms >= 0, ttl_ms > 0 ? (uint64_t) ttl_ms * 1000000ULL : 0, (size_t) max_bytes);
+    RETURN_TRUE;
+}
+
+/* parallelx_trace_enable(capacity = 65536) - 記録済みのイベントは破棄される */
+PHP_FUNCTION(parallelx_trace_enable) {
+    zend_long capacity = 65536;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "|l", &capacity) == FAILURE) {
+        RETURN_FALSE;
+    }
+    if (capacity <= 0) {
+        php_error_docref(NULL, E_WARNING, "parallelx_trace_enable: capacity must be positive");
+        RETURN_FALSE;
+    }
+    if (px_trace_enable((size_t) capacity) != 0) {
+        php_error_docref(NULL, E_WARNING, "parallelx_trace_enable: out of memory");
+        RETURN_FALSE;
+    }
+    RETURN_TRUE;
+}
+
+/* parallelx_trace_disable() - 記録を止める。バッファはdumpできるよう残す */
+PHP_FUNCTION(parallelx_trace_disable) {
+    if (zend_parse_parameters_none() == FAILURE) RETURN_FALSE;
+    px_trace_disable();
+    RETURN_TRUE;
+}
+
+/* parallelx_trace_dump(path) -> int events written (Chrome trace event JSON) */
+PHP_FUNCTION(parallelx_trace_dump) {
+    char *path = NULL;
+    size_t path_len = 0;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "p", &path, &path_len) == FAILURE) {
+        RETURN_FALSE;
+    }
+    long n = px_trace_dump(path);
+    if (n < 0) {
+        php_error_docref(NULL, E_WARNING, "parallelx_trace_dump: cannot write %s", path);
+        RETURN_FALSE;
+    }
+    RETURN_LONG(n);
+}
+
+/* handle配列(parallelx_shm_allocの戻り値)かidを受け付ける */
+static px_shm_buffer *shm_from_zval(zval *handle) {
+    zend_long id = 0;
+    if (Z_TYPE_P(handle) == IS_ARRAY) {
+        zval *zid = zend_hash_str_find(Z_ARRVAL_P(handle), "id", sizeof("id") - 1);
+        if (!zid || Z_TYPE_P(zid) != IS_LONG) return NULL;
+        id = Z_LVAL_P(zid);
+    } else if (Z_TYPE_P(handle) == IS_LONG) {
+        id = Z_LVAL_P(handle);
+    } else {
+        return NULL;
+    }
+    return px_shm_find(id);
+}
+
+/* parallelx_shm_alloc(type, length) -> handle (int8/uint8/int32/float) */
+PHP_FUNCTION(parallelx_shm_alloc) {
+    char *type_name = NULL;
+    size_t type_len = 0;
+    zend_long length = 0;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "sl", &type_name, &type_len, &length) == FAILURE) {
+        RETURN_FALSE;
+    }
+    if (!px_initialized) {
+        php_error_docref(NULL, E_WARNING, "parallelx_shm_alloc: not initialized");
+        RETURN_FALSE;
+    }
+    px_shm_type type;
+    size_t elem_size = 0;
+    if (px_shm_type_from_name(type_name, &type, &elem_size) != 0) {
+        php_error_docref(NULL, E_WARNING, "parallelx_shm_alloc: unknown type '%s'", type_name);
+        RETURN_FALSE;
+    }
+    if (length <= 0) {
+        php_error_docref(NULL, E_WARNING, "parallelx_shm_alloc: length must be positive");
+        RETURN_FALSE;
+    }
+    px_shm_buffer *b = px_shm_alloc(type, elem_size, (size_t) length);
+    if (!b) {
+        php_error_docref(NULL, E_WARNING, "parallelx_shm_alloc: failed to map shared buffer");
+        RETURN_FALSE;
+    }
+    px_shm_handle(b, return_value);
+}
+
+/* parallelx_shm_read(handle) -> string (raw bytes, machine byte order) */
+PHP_FUNCTION(parallelx_shm_read) {
+    zval *handle = NULL;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "z", &handle) == FAILURE) {
+        RETURN_FALSE;
+    }
+    px_shm_buffer *b = shm_from_zval(handle);
+    if (!b) {
+        php_error_docref(NULL, E_WARNING, "parallelx_shm_read: unknown buffer");
+        RETURN_FALSE;
+    }
+    RETVAL_STRINGL((const char *) b->addr, b->size);
+}
+
+/* parallelx_shm_unpack(handle) -> array of int|float */
+PHP_FUNCTION(parallelx_shm_unpack) {
+    zval *handle = NULL;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "z", &handle) == FAILURE) {
+        RETURN_FALSE;
+    }
+    px_shm_buffer *b = shm_from_zval(handle);
+    if (!b) {
+        php_error_docref(NULL, E_WARNING, "parallelx_shm_unpack: unknown buffer");
+        RETURN_FALSE;
+    }
+    px_shm_to_array(b, return_value);
+}
+
+/* parallelx_shm_free(handle) */
+PHP_FUNCTION(parallelx_shm_free) {
+    zval *handle = NULL;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "z", &handle) == FAILURE) {
+        RETURN_FALSE;
+    }
+    px_shm_buffer *b = shm_from_zval(handle);
+    if (!b) RETURN_FALSE;
+    px_shm_free(b->id);
+    RETURN_TRUE;
+}
+
 PHP_MINFO_FUNCTION(parallelx) {
     php_info_print_table_start();
     php_info_print_table_row(2, "parallelx support", "enabled");
     php_info_print_table_row(2, "parallelx version", PARALLELX_VERSION);
     php_info_print_table_row(2, "worker script", worker_script_path[0] ? worker_script_path : "not created");
+    php_info_print_table_row(2, "backend", px_active_backend == PX_BACKEND_THREAD ? "thread" : "process");
+#ifdef HAVE_PX_ZLIB
+    php_info_print_table_row(2, "native kernels", "deflate, crc32, noise2d, f32_affine");
+#else
+    php_info_print_table_row(2, "native kernels", "crc32, noise2d, f32_affine");
+#endif
+#ifdef ZTS
+    php_info_print_table_row(2, "thread backend", "available");
+#else
+    php_info_print_table_row(2, "thread backend", "unavailable (requires ZTS)");
+#endif
+    php_info_print_table_end();
+
+    char buf[64];
+    php_info_print_table_start();
+    php_info_print_table_header(2, "parallelx stats", "value");
+    snprintf(buf, sizeof(buf), "%d", px_worker_count);
+    php_info_print_table_row(2, "workers", buf);
+    snprintf(buf, sizeof(buf), "%llu (peak %llu)", (unsigned long long) px_stats.queue_depth,
+             (unsigned long long) px_stats.queue_peak);
+    php_info_print_table_row(2, "queue depth", buf);
+    snprintf(buf, sizeof(buf), "%llu", (unsigned long long) px_stats.tasks_submitted);
+    php_info_print_table_row(2, "tasks submitted", buf);
+    snprintf(buf, sizeof(buf), "%llu", (unsigned long long) px_stats.tasks_completed);
+    php_info_print_table_row(2, "tasks completed", buf);
+    snprintf(buf, sizeof(buf), "%llu", (unsigned long long) px_stats.tasks_failed);
+    php_info_print_table_row(2, "tasks failed", buf);
+    snprintf(buf, sizeof(buf), "%llu", (unsigned long long) px_stats.callback_not_found);
+    php_info_print_table_row(2, "callback not found", buf);
+    snprintf(buf, sizeof(buf), "%llu", (unsigned long long) px_stats.worker_restarts);
+    php_info_print_table_row(2, "worker restarts", buf);
+    snprintf(buf, sizeof(buf), "%llu / %llu", (unsigned long long) px_stats.bytes_sent,
+             (unsigned long long) px_stats.bytes_received);
+    php_info_print_table_row(2, "bytes sent / received", buf);
+    snprintf(buf, sizeof(buf), "p50 %llu / p99 %llu", (unsigned long long) px_hist_percentile(&px_stats.queue_wait, 50.0),
+             (unsigned long long) px_hist_percentile(&px_stats.queue_wait, 99.0));
+    php_info_print_table_row(2, "queue wait (us)", buf);
+    snprintf(buf, sizeof(buf), "p50 %llu / p99 %llu", (unsigned long long) px_hist_percentile(&px_stats.execution, 50.0),
+             (unsigned long long) px_hist_percentile(&px_stats.execution, 99.0));
+    php_info_print_table_row(2, "execution (us)", buf);
+    snprintf(buf, sizeof(buf), "p50 %llu / p99 %llu", (unsigned long long) px_hist_percentile(&px_stats.end_to_end, 50.0),
+             (unsigned long long) px_hist_percentile(&px_stats.end_to_end, 99.0));
+    php_info_print_table_row(2, "end to end (us)", buf);
+    snprintf(buf, sizeof(buf), "p50 %llu / p99 %llu", (unsigned long long) px_hist_percentile(&px_stats.callback, 50.0),
+             (unsigned long long) px_hist_percentile(&px_stats.callback, 99.0));
+    php_info_print_table_row(2, "callback (us)", buf);
     php_info_print_table_end();
 }
 
@@ -316,12 +1026,24 @@ ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_parallelx_submit_token, 0, 0, 2)
     ZEND_ARG_CALLABLE_INFO(0, task, 0)
-    ZEND_ARG_CALLABLE_INFO(0, callback, 0)
+    ZEND_ARG_CALLABLE_INFO(0, callback, 1)
+    ZEND_ARG_INFO(0, options)
 ZEND_END_ARG_INFO()
 
-ZEND_BEGIN_ARG_INFO_EX(arginfo_parallelx_submit_desc, 0, 0, 2)
+ZEND_BEGIN_ARG_INFO_EX(arginfo_parallelx_submit_desc, 0, 0, 1)
     ZEND_ARG_INFO(0, desc)
-    ZEND_ARG_CALLABLE_INFO(0, callback, 0)
+    ZEND_ARG_CALLABLE_INFO(0, callback, 1)
+    ZEND_ARG_INFO(0, options)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_parallelx_submit_fork, 0, 0, 2)
+    ZEND_ARG_CALLABLE_INFO(0, task, 0)
+    ZEND_ARG_INFO(0, args)
+    ZEND_ARG_CALLABLE_INFO(0, callback, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_parallelx_fork_limit, 0, 0, 1)
+    ZEND_ARG_INFO(0, max)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_parallelx_poll, 0, 0, 0)
@@ -330,13 +1052,95 @@ ZEND_END_ARG_INFO()
 ZEND_BEGIN_ARG_INFO_EX(arginfo_parallelx_shutdown, 0, 0, 0)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_parallelx_stats, 0, 0, 0)
+    ZEND_ARG_INFO(0, reset)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_parallelx_poll_results, 0, 0, 0)
+    ZEND_ARG_INFO(0, max)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_parallelx_set_batch_callback, 0, 0, 2)
+    ZEND_ARG_INFO(0, token)
+    ZEND_ARG_INFO(0, callback)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_parallelx_register_closure, 0, 0, 1)
+    ZEND_ARG_OBJ_INFO(0, closure, Closure, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_parallelx_token_usage, 0, 0, 0)
+    ZEND_ARG_INFO(0, token)
+    ZEND_ARG_INFO(0, reset)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_parallelx_reload, 0, 0, 0)
+    ZEND_ARG_INFO(0, options)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_parallelx_add_remote, 0, 0, 1)
+    ZEND_ARG_INFO(0, address)
+    ZEND_ARG_INFO(0, slots)
+    ZEND_ARG_INFO(0, secret)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_parallelx_owner_config, 0, 0, 1)
+    ZEND_ARG_INFO(0, owner)
+    ZEND_ARG_INFO(0, weight)
+    ZEND_ARG_INFO(0, max_inflight)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_parallelx_memoize, 0, 0, 2)
+    ZEND_ARG_INFO(0, token)
+    ZEND_ARG_INFO(0, ttl_ms)
+    ZEND_ARG_INFO(0, max_bytes)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_parallelx_trace_enable, 0, 0, 0)
+    ZEND_ARG_INFO(0, capacity)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_parallelx_trace_disable, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_parallelx_trace_dump, 0, 0, 1)
+    ZEND_ARG_INFO(0, path)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_parallelx_shm_alloc, 0, 0, 2)
+    ZEND_ARG_INFO(0, type)
+    ZEND_ARG_INFO(0, length)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_parallelx_shm_handle, 0, 0, 1)
+    ZEND_ARG_INFO(0, handle)
+ZEND_END_ARG_INFO()
+
 const zend_function_entry parallelx_functions[] = {
     PHP_FE(parallelx_init, arginfo_parallelx_init)
     PHP_FE(parallelx_register, arginfo_parallelx_register)
+    PHP_FE(parallelx_register_closure, arginfo_parallelx_register_closure)
     PHP_FE(parallelx_submit_token, arginfo_parallelx_submit_token)
     PHP_FE(parallelx_submit_desc, arginfo_parallelx_submit_desc)
+    PHP_FE(parallelx_submit_fork, arginfo_parallelx_submit_fork)
+    PHP_FE(parallelx_fork_limit, arginfo_parallelx_fork_limit)
     PHP_FE(parallelx_poll, arginfo_parallelx_poll)
     PHP_FE(parallelx_shutdown, arginfo_parallelx_shutdown)
+    PHP_FE(parallelx_stats, arginfo_parallelx_stats)
+    PHP_FE(parallelx_poll_results, arginfo_parallelx_poll_results)
+    PHP_FE(parallelx_set_batch_callback, arginfo_parallelx_set_batch_callback)
+    PHP_FE(parallelx_token_usage, arginfo_parallelx_token_usage)
+    PHP_FE(parallelx_reload, arginfo_parallelx_reload)
+    PHP_FE(parallelx_add_remote, arginfo_parallelx_add_remote)
+    PHP_FE(parallelx_owner_config, arginfo_parallelx_owner_config)
+    PHP_FE(parallelx_memoize, arginfo_parallelx_memoize)
+    PHP_FE(parallelx_trace_enable, arginfo_parallelx_trace_enable)
+    PHP_FE(parallelx_trace_disable, arginfo_parallelx_trace_disable)
+    PHP_FE(parallelx_trace_dump, arginfo_parallelx_trace_dump)
+    PHP_FE(parallelx_shm_alloc, arginfo_parallelx_shm_alloc)
+    PHP_FE(parallelx_shm_read, arginfo_parallelx_shm_handle)
+    PHP_FE(parallelx_shm_unpack, arginfo_parallelx_shm_handle)
+    PHP_FE(parallelx_shm_free, arginfo_parallelx_shm_handle)
     PHP_FE_END
 };
 
@@ -5,11 +5,30 @@
 #include "php.h"
 
 PHP_FUNCTION(parallelx_init); /* (int workers, string php_cli = null,
-                                string worker_script = null, string autoload = null) */
+                                string worker_script = null, string autoload = null,
+                                string backend = "process") */
 PHP_FUNCTION(parallelx_register); /* (string source, string bound_b64) -> string token */
-PHP_FUNCTION(parallelx_submit_token); /* (string token, array args, callable onComplete) */
-PHP_FUNCTION(parallelx_submit_desc); /* (array descriptor, callable onComplete) */
+PHP_FUNCTION(parallelx_register_closure); /* (Closure closure) -> string token */
+PHP_FUNCTION(parallelx_submit_token); /* (string token, array args, ?callable onComplete = null, array options = []) -> true | int task_id */
+PHP_FUNCTION(parallelx_submit_desc); /* (array descriptor, ?callable onComplete = null, array options = []) -> true | int task_id */
+PHP_FUNCTION(parallelx_submit_fork); /* (callable task, array args, ?callable onComplete = null) Linux only */
+PHP_FUNCTION(parallelx_fork_limit); /* (int max) -> int previous */
 PHP_FUNCTION(parallelx_poll); /* () -> bool */
+PHP_FUNCTION(parallelx_poll_results); /* (int max = 0) -> array task_id => result */
+PHP_FUNCTION(parallelx_token_usage); /* (?string token = null, bool reset = false) -> array */
+PHP_FUNCTION(parallelx_set_batch_callback); /* (string token, ?callable onBatch) -> bool */
 PHP_FUNCTION(parallelx_shutdown); /* () -> bool */
+PHP_FUNCTION(parallelx_stats); /* (bool reset = false) -> array */
+PHP_FUNCTION(parallelx_reload); /* (array options = []) -> bool */
+PHP_FUNCTION(parallelx_add_remote); /* (string address, int slots = 0, string secret = "") -> int slots added */
+PHP_FUNCTION(parallelx_owner_config); /* (string owner, int weight = 1, int max_inflight = 0) -> bool */
+PHP_FUNCTION(parallelx_memoize); /* (string token, int ttl_ms, int max_bytes = 4MB) -> bool */
+PHP_FUNCTION(parallelx_trace_enable); /* (int capacity = 65536) -> bool */
+PHP_FUNCTION(parallelx_trace_disable); /* () -> bool */
+PHP_FUNCTION(parallelx_trace_dump); /* (string path) -> int */
+PHP_FUNCTION(parallelx_shm_alloc); /* (string type, int length) -> array handle */
+PHP_FUNCTION(parallelx_shm_read); /* (array|int handle) -> string */
+PHP_FUNCTION(parallelx_shm_unpack); /* (array|int handle) -> array */
+PHP_FUNCTION(parallelx_shm_free); /* (array|int handle) -> bool */
 
 #endif /* PARALLELX_H */
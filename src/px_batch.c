@@ -0,0 +1,119 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "px_internal.h"
+
+/*
+ * callbackを持たないタスクの結果の受け皿。
+ * - callbackなし: parallelx_poll_results() が task_id => result の配列で取り出す
+ * - tokenにbatch callbackがある: poll 1回分の結果をまとめて1回だけ呼ぶ
+ * タスク側のcallback zvalは IS_NULL か、closure_entry を指す IS_PTR になる
+ */
+
+static zval results;                     /* task_id => result。IS_UNDEF(0) なら空 */
+static closure_entry *batch_head = NULL; /* 今回のpollで結果が溜まったtoken */
+
+void px_batch_target(closure_entry *e, zval *out) {
+    if (e && !Z_ISUNDEF(e->batch_cb)) ZVAL_PTR(out, e);
+    else ZVAL_NULL(out);
+}
+
+static void collect(zval *table, zval *assoc) {
+    if (Z_ISUNDEF_P(table)) array_init(table);
+    zval *ztid = Z_TYPE_P(assoc) == IS_ARRAY ? zend_hash_str_find(Z_ARRVAL_P(assoc), "task_id", sizeof("task_id") - 1) : NULL;
+    zend_long tid = 0;
+    if (ztid) tid = Z_TYPE_P(ztid) == IS_LONG ? Z_LVAL_P(ztid) : zval_get_long(ztid);
+    Z_TRY_ADDREF_P(assoc);
+    zend_hash_index_update(Z_ARRVAL_P(table), tid, assoc);
+}
+
+void px_batch_collect(zval *cb, zval *assoc) {
+    closure_entry *e = Z_TYPE_P(cb) == IS_PTR ? (closure_entry *) Z_PTR_P(cb) : NULL;
+    /* batch callbackが外された後に届いた分は poll_results へ回す */
+    if (!e || Z_ISUNDEF(e->batch_cb)) {
+        collect(&results, assoc);
+        return;
+    }
+    if (Z_ISUNDEF(e->batch)) {
+        e->batch_next = batch_head;
+        batch_head = e;
+    }
+    collect(&e->batch, assoc);
+}
+
+/* parallelx_poll の最後に、tokenごとに1回だけbatch callbackを呼ぶ */
+void px_batch_flush(void) {
+    while (batch_head) {
+        closure_entry *e = batch_head;
+        batch_head = e->batch_next;
+        e->batch_next = NULL;
+        if (Z_ISUNDEF(e->batch)) continue; /* flush前にbatch callbackが外された */
+
+        /* callback内で set_batch_callback されても壊れないよう自分の参照で呼ぶ */
+        zval batch, cb, retval;
+        ZVAL_COPY_VALUE(&batch, &e->batch);
+        ZVAL_UNDEF(&e->batch);
+        ZVAL_COPY(&cb, &e->batch_cb);
+        ZVAL_UNDEF(&retval);
+        uint64_t cb_ns = px_now_ns();
+        if (call_user_function(NULL, NULL, &cb, &retval, 1, &batch) != SUCCESS) {
+            php_error_docref(NULL, E_WARNING, "parallelx: batch callback invocation failed");
+        }
+        px_hist_record(&px_stats.callback, (px_now_ns() - cb_ns) / 1000);
+        if (!Z_ISUNDEF(retval)) zval_ptr_dtor(&retval);
+        zval_ptr_dtor(&cb);
+        zval_ptr_dtor(&batch);
+    }
+}
+
+/* NULLでbatch callbackを外す。溜まっている分は poll_results へ移す */
+void px_batch_set_callback(closure_entry *e, zval *cb) {
+    if (!Z_ISUNDEF(e->batch_cb)) zval_ptr_dtor(&e->batch_cb);
+    ZVAL_UNDEF(&e->batch_cb);
+    if (cb) {
+        ZVAL_COPY(&e->batch_cb, cb);
+        return;
+    }
+    if (!Z_ISUNDEF(e->batch)) {
+        zval *v;
+        ZEND_HASH_FOREACH_VAL(Z_ARRVAL(e->batch), v) {
+            collect(&results, v);
+        } ZEND_HASH_FOREACH_END();
+        zval_ptr_dtor(&e->batch);
+        ZVAL_UNDEF(&e->batch);
+    }
+}
+
+/* 溜まった結果を最大max件(0なら全部)取り出して return_value に入れる */
+void px_batch_take(zend_long max, zval *out) {
+    if (Z_ISUNDEF(results) || (max <= 0 || zend_hash_num_elements(Z_ARRVAL(results)) <= (uint32_t) max)) {
+        if (Z_ISUNDEF(results)) array_init(out);
+        else ZVAL_COPY_VALUE(out, &results);
+        ZVAL_UNDEF(&results);
+        return;
+    }
+    array_init_size(out, (uint32_t) max);
+    zend_ulong tid;
+    zval *v;
+    zend_long n = 0;
+    ZEND_HASH_FOREACH_NUM_KEY_VAL(Z_ARRVAL(results), tid, v) {
+        if (n++ >= max) break;
+        Z_TRY_ADDREF_P(v);
+        zend_hash_index_update(Z_ARRVAL_P(out), tid, v);
+    } ZEND_HASH_FOREACH_END();
+    ZEND_HASH_FOREACH_NUM_KEY(Z_ARRVAL_P(out), tid) {
+        zend_hash_index_del(Z_ARRVAL(results), tid);
+    } ZEND_HASH_FOREACH_END();
+}
+
+zend_long px_batch_pending(void) {
+    return Z_ISUNDEF(results) ? 0 : (zend_long) zend_hash_num_elements(Z_ARRVAL(results));
+}
+
+/* 受け取られなかった結果を捨てる。closure_entry側は px_registry_free_all で解放 */
+void px_batch_free_all(void) {
+    if (!Z_ISUNDEF(results)) zval_ptr_dtor(&results);
+    ZVAL_UNDEF(&results);
+    batch_head = NULL;
+}
@@ -0,0 +1,470 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "px_internal.h"
+#include "ext/standard/base64.h"
+#include "ext/standard/php_var.h"
+#include "zend_closures.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+/*
+ * parallelx_register_closure() 用のクロージャ抽出。
+ * ソースファイルは path + mtime + size をキーに行オフセット付きでキャッシュし、
+ * op_array の開始行から function / fn を字句単位で探してソースの範囲を切り出す。
+ * 同じ行に複数のクロージャがある場合は引数名と終了行で見分け、それでも区別できなければエラーにする
+ */
+
+typedef struct px_src_file {
+    char *path;
+    time_t mtime;
+    off_t size;
+    char *data;
+    size_t len;
+    size_t *lines; /* lines[i] = i+1行目の先頭オフセット */
+    uint32_t nlines;
+    struct px_src_file *next;
+} px_src_file;
+
+static px_src_file *src_head = NULL;
+
+static void src_free(px_src_file *f) {
+    free(f->path);
+    free(f->data);
+    free(f->lines);
+    free(f);
+}
+
+static int src_load(px_src_file *f, const char *path, const struct stat *st) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return -1;
+    size_t cap = (size_t) st->st_size;
+    char *data = (char *) malloc(cap + 1);
+    size_t len = data ? fread(data, 1, cap, fp) : 0;
+    fclose(fp);
+    if (!data || len != cap) {
+        free(data);
+        return -1;
+    }
+    data[len] = '\0';
+
+    uint32_t n = 1;
+    for (size_t i = 0; i < len; ++i) {
+        if (data[i] == '\n') n++;
+    }
+    size_t *lines = (size_t *) malloc(n * sizeof(size_t));
+    if (!lines) {
+        free(data);
+        return -1;
+    }
+    uint32_t k = 0;
+    lines[k++] = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (data[i] == '\n') lines[k++] = i + 1;
+    }
+
+    free(f->data);
+    free(f->lines);
+    f->data = data;
+    f->len = len;
+    f->lines = lines;
+    f->nlines = n;
+    f->mtime = st->st_mtime;
+    f->size = st->st_size;
+    return 0;
+}
+
+/* 変更されていなければキャッシュをそのまま返す */
+static px_src_file *src_get(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return NULL;
+    px_src_file *f = src_head;
+    while (f && strcmp(f->path, path) != 0) f = f->next;
+    if (f && f->mtime == st.st_mtime && f->size == st.st_size) return f;
+
+    if (!f) {
+        f = (px_src_file *) calloc(1, sizeof(px_src_file));
+        if (!f) return NULL;
+        f->path = px_strdup(path);
+        if (!f->path || src_load(f, path, &st) != 0) {
+            src_free(f);
+            return NULL;
+        }
+        f->next = src_head;
+        src_head = f;
+        return f;
+    }
+    return src_load(f, path, &st) == 0 ? f : NULL;
+}
+
+static uint32_t src_line_of(const px_src_file *f, size_t pos) {
+    uint32_t lo = 0, hi = f->nlines;
+    while (hi - lo > 1) {
+        uint32_t mid = (lo + hi) / 2;
+        if (f->lines[mid] <= pos) lo = mid;
+        else hi = mid;
+    }
+    return lo + 1;
+}
+
+/* ---- 字句の読み飛ばし ---- */
+
+static int is_ident(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' ||
+           (unsigned char) c >= 0x80;
+}
+
+/* heredoc / nowdoc: s[i] は "<<<"。終端識別子の直後を返す */
+static size_t skip_heredoc(const char *s, size_t i, size_t end) {
+    i += 3;
+    while (i < end && (s[i] == ' ' || s[i] == '\t')) i++;
+    if (i < end && (s[i] == '\'' || s[i] == '"')) i++;
+    size_t id = i;
+    while (i < end && is_ident(s[i])) i++;
+    size_t id_len = i - id;
+    if (id_len == 0) return i;
+    while (i < end) {
+        while (i < end && s[i] != '\n') i++;
+        if (i >= end) return end;
+        i++;
+        size_t j = i;
+        while (j < end && (s[j] == ' ' || s[j] == '\t')) j++;
+        if (j + id_len <= end && memcmp(s + j, s + id, id_len) == 0 && (j + id_len == end || !is_ident(s[j + id_len]))) {
+            return j + id_len;
+        }
+    }
+    return end;
+}
+
+/* 文字列かコメントならその直後、そうでなければ i をそのまま返す */
+static size_t skip_literal(const char *s, size_t i, size_t end) {
+    char c = s[i];
+    if (c == '\'' || c == '"' || c == '`') {
+        for (++i; i < end; ++i) {
+            if (s[i] == '\\') ++i;
+            else if (s[i] == c) return i + 1;
+        }
+        return end;
+    }
+    if (c == '#' && !(i + 1 < end && s[i + 1] == '[')) {
+        while (i < end && s[i] != '\n') i++;
+        return i;
+    }
+    if (c == '/' && i + 1 < end && s[i + 1] == '/') {
+        while (i < end && s[i] != '\n') i++;
+        return i;
+    }
+    if (c == '/' && i + 1 < end && s[i + 1] == '*') {
+        const char *e = strstr(s + i + 2, "*/");
+        return e && (size_t) (e - s) + 2 <= end ? (size_t) (e - s) + 2 : end;
+    }
+    if (c == '<' && i + 2 < end && s[i + 1] == '<' && s[i + 2] == '<') return skip_heredoc(s, i, end);
+    return i;
+}
+
+static size_t skip_space(const char *s, size_t i, size_t end) {
+    while (i < end) {
+        if (s[i] == ' ' || s[i] == '\t' || s[i] == '\r' || s[i] == '\n') {
+            i++;
+            continue;
+        }
+        if (s[i] == '#' || s[i] == '/') {
+            size_t j = skip_literal(s, i, end);
+            if (j == i) break;
+            i = j;
+            continue;
+        }
+        break;
+    }
+    return i;
+}
+
+static int keyword_at(const char *s, size_t i, size_t end, const char *kw) {
+    size_t n = strlen(kw);
+    if (i + n > end || strncasecmp(s + i, kw, n) != 0) return 0;
+    if (i + n < end && is_ident(s[i + n])) return 0;
+    return 1;
+}
+
+/* s[i] の開き括弧に対応する閉じ括弧の位置。無ければ end */
+static size_t match_bracket(const char *s, size_t i, size_t end) {
+    int depth = 0;
+    while (i < end) {
+        size_t j = skip_literal(s, i, end);
+        if (j != i) {
+            i = j;
+            continue;
+        }
+        char c = s[i];
+        if (c == '(' || c == '[' || c == '{') depth++;
+        else if (c == ')' || c == ']' || c == '}') {
+            if (--depth == 0) return i;
+        }
+        i++;
+    }
+    return end;
+}
+
+/* ---- 候補の解析 ---- */
+
+typedef struct closure_span {
+    size_t start;
+    size_t end;
+    uint32_t nparams;
+    int params_match;
+} closure_span;
+
+/* 引数リスト (...) の引数名を op_array と比べる。p は '(' の位置、戻り値は ')' の位置 */
+static size_t parse_params(const char *s, size_t p, size_t end, const zend_op_array *op, closure_span *out) {
+    size_t close = match_bracket(s, p, end);
+    uint32_t want = op->num_args + ((op->fn_flags & ZEND_ACC_VARIADIC) ? 1 : 0);
+    uint32_t n = 0;
+    int ok = 1, expect = 1, depth = 0;
+    for (size_t i = p + 1; i < close;) {
+        size_t j = skip_literal(s, i, close);
+        if (j != i) {
+            i = j;
+            continue;
+        }
+        char c = s[i];
+        if (c == '(' || c == '[' || c == '{') depth++;
+        else if (c == ')' || c == ']' || c == '}') depth--;
+        else if (c == ',' && depth == 0) expect = 1;
+        else if (c == '$' && depth == 0 && expect) {
+            size_t name = ++i;
+            while (i < close && is_ident(s[i])) i++;
+            if (n >= want || !op->vars || ZSTR_LEN(op->vars[n]) != i - name ||
+                memcmp(ZSTR_VAL(op->vars[n]), s + name, i - name) != 0) {
+                ok = 0;
+            }
+            n++;
+            expect = 0;
+            continue;
+        }
+        i++;
+    }
+    out->nparams = n;
+    out->params_match = ok && n == want;
+    return close;
+}
+
+/* s[p] が function / fn のとき、そのクロージャの範囲を求める。0: 候補ではない */
+static int parse_candidate(const char *s, size_t p, size_t end, const zend_op_array *op, closure_span *out) {
+    int arrow = keyword_at(s, p, end, "fn");
+    size_t i = skip_space(s, p + (arrow ? 2 : 8), end);
+    if (i < end && s[i] == '&') i = skip_space(s, i + 1, end);
+    if (i >= end || s[i] != '(') return 0; /* 名前付き関数の宣言など */
+
+    size_t close = parse_params(s, i, end, op, out);
+    if (close >= end) return 0;
+    i = skip_space(s, close + 1, end);
+
+    if (!arrow) {
+        if (keyword_at(s, i, end, "use")) {
+            i = skip_space(s, i + 3, end);
+            if (i >= end || s[i] != '(') return 0;
+            i = skip_space(s, match_bracket(s, i, end) + 1, end);
+        }
+        /* 戻り値の型を飛ばして本体の { まで */
+        while (i < end && s[i] != '{' && s[i] != ';') {
+            size_t j = skip_literal(s, i, end);
+            i = j != i ? j : i + 1;
+        }
+        if (i >= end || s[i] != '{') return 0;
+        size_t body = match_bracket(s, i, end);
+        if (body >= end) return 0;
+        out->end = body + 1;
+        return 1;
+    }
+
+    /* fn: => の後の式は深さ0の , ; ) ] } で終わる */
+    while (i + 1 < end && !(s[i] == '=' && s[i + 1] == '>')) {
+        size_t j = skip_literal(s, i, end);
+        i = j != i ? j : i + 1;
+    }
+    if (i + 1 >= end) return 0;
+    i += 2;
+    int depth = 0;
+    while (i < end) {
+        size_t j = skip_literal(s, i, end);
+        if (j != i) {
+            i = j;
+            continue;
+        }
+        char c = s[i];
+        if (c == '(' || c == '[' || c == '{') depth++;
+        else if (c == ')' || c == ']' || c == '}') {
+            if (depth == 0) break;
+            depth--;
+        } else if ((c == ',' || c == ';') && depth == 0) break;
+        i++;
+    }
+    while (i > p && (s[i - 1] == ' ' || s[i - 1] == '\t' || s[i - 1] == '\r' || s[i - 1] == '\n')) i--;
+    out->end = i;
+    return 1;
+}
+
+/* 開始行の function / fn を順に調べ、引数名と終了行が一致するものを選ぶ。
+ * 0: 見つかった, -1: 無い, -2: 区別できない候補が複数ある(推測はしない) */
+static int find_span(const px_src_file *f, const zend_op_array *op, closure_span *out) {
+    if (op->line_start == 0 || op->line_start > f->nlines) return -1;
+    const char *s = f->data;
+    size_t end = f->len;
+    size_t line_begin = f->lines[op->line_start - 1];
+    size_t line_end = op->line_start < f->nlines ? f->lines[op->line_start] : end;
+
+    closure_span by_params = {0};
+    int full = 0, partial = 0;
+    for (size_t i = line_begin; i < line_end;) {
+        size_t j = skip_literal(s, i, end);
+        if (j != i) {
+            i = j;
+            continue;
+        }
+        int boundary = i == 0 || (!is_ident(s[i - 1]) && s[i - 1] != '$' && s[i - 1] != '>' && s[i - 1] != ':');
+        closure_span c = {0};
+        if (!boundary || !(keyword_at(s, i, end, "function") || keyword_at(s, i, end, "fn"))) {
+            i++;
+            continue;
+        }
+        if (parse_candidate(s, i, end, op, &c) && c.params_match) {
+            /* static function / static fn */
+            size_t b = i;
+            while (b > line_begin && (s[b - 1] == ' ' || s[b - 1] == '\t')) b--;
+            c.start = i;
+            if (b >= line_begin + 6 && strncasecmp(s + b - 6, "static", 6) == 0 && (b == 6 || !is_ident(s[b - 7]))) {
+                c.start = b - 6;
+            }
+            if (src_line_of(f, c.end - 1) == op->line_end) {
+                if (full++ == 0) *out = c;
+            } else if (partial++ == 0) {
+                by_params = c;
+            }
+        }
+        i += 2;
+    }
+    if (full == 1) return 0;
+    if (full > 1) return -2;
+    /* 終了行の記録がずれている場合は、引数名だけで一意に決まるときに限って使う */
+    if (partial == 1) {
+        *out = by_params;
+        return 0;
+    }
+    return partial > 1 ? -2 : -1;
+}
+
+/* ---- バインド変数 ---- */
+
+/* use() とstatic変数の現在の値を base64(serialize()) にする。空なら "" */
+static zend_string *bound_vars_b64(const zend_function *fn) {
+    if (!fn->op_array.static_variables) return ZSTR_EMPTY_ALLOC();
+    HashTable *ht = ZEND_MAP_PTR_GET(fn->op_array.static_variables_ptr);
+    if (!ht) ht = fn->op_array.static_variables;
+    if (zend_hash_num_elements(ht) == 0) return ZSTR_EMPTY_ALLOC();
+
+    zval vars;
+    array_init_size(&vars, zend_hash_num_elements(ht));
+    zend_string *key;
+    zval *v;
+    ZEND_HASH_FOREACH_STR_KEY_VAL(ht, key, v) {
+        if (!key) continue;
+        zval copy;
+        ZVAL_COPY_DEREF(&copy, v);
+        /* 未評価の static $x = CONST; */
+        if (Z_TYPE(copy) == IS_CONSTANT_AST && zval_update_constant_ex(&copy, fn->common.scope) != SUCCESS) {
+            zval_ptr_dtor(&copy);
+            zval_ptr_dtor(&vars);
+            return NULL;
+        }
+        zend_hash_update(Z_ARRVAL(vars), key, &copy);
+    } ZEND_HASH_FOREACH_END();
+
+    smart_str buf = {0};
+    php_serialize_data_t var_hash;
+    PHP_VAR_SERIALIZE_INIT(var_hash);
+    php_var_serialize(&buf, &vars, &var_hash);
+    PHP_VAR_SERIALIZE_DESTROY(var_hash);
+    zval_ptr_dtor(&vars);
+    if (EG(exception) || !buf.s) {
+        smart_str_free(&buf);
+        return NULL;
+    }
+    zend_string *b64 = php_base64_encode((const unsigned char *) ZSTR_VAL(buf.s), ZSTR_LEN(buf.s));
+    smart_str_free(&buf);
+    return b64;
+}
+
+static uint64_t fnv1a64(uint64_t h, const char *p, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        h ^= (unsigned char) p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* クロージャのソースとバインド変数を取り出して登録する。内容が同じなら同じtokenを返す */
+char *px_closure_register(zval *closure, const char **err) {
+    const zend_function *fn = zend_get_closure_method_def(Z_OBJ_P(closure));
+    if (!fn || fn->type != ZEND_USER_FUNCTION || !fn->op_array.filename) {
+        *err = "internal functions cannot be registered";
+        return NULL;
+    }
+    const zend_op_array *op = &fn->op_array;
+    px_src_file *f = src_get(ZSTR_VAL(op->filename));
+    if (!f) {
+        *err = "cannot read closure source file";
+        return NULL;
+    }
+    closure_span span;
+    int found = find_span(f, op, &span);
+    if (found == -2) {
+        *err = "ambiguous closure source (several closures with the same parameters on one line)";
+        return NULL;
+    }
+    if (found != 0) {
+        *err = "closure source not found (file changed since it was compiled?)";
+        return NULL;
+    }
+    zend_string *bound = bound_vars_b64(fn);
+    if (!bound) {
+        if (EG(exception)) zend_clear_exception();
+        *err = "captured variables are not serializable";
+        return NULL;
+    }
+
+    size_t len = span.end - span.start;
+    char *source = (char *) malloc(len + 1);
+    if (!source) {
+        zend_string_release(bound);
+        *err = "out of memory";
+        return NULL;
+    }
+    memcpy(source, f->data + span.start, len);
+    source[len] = '\0';
+
+    uint64_t h = fnv1a64(1469598103934665603ULL, source, len + 1);
+    h = fnv1a64(h, ZSTR_VAL(bound), ZSTR_LEN(bound));
+    char token[32];
+    snprintf(token, sizeof(token), "px_clo_%016llx", (unsigned long long) h);
+
+    char *out = px_registry_insert_named(token, source, ZSTR_VAL(bound));
+    free(source);
+    zend_string_release(bound);
+    if (!out) *err = "could not register closure (out of memory or too many token collisions)";
+    return out;
+}
+
+void px_closure_free_all(void) {
+    px_src_file *f = src_head;
+    while (f) {
+        px_src_file *nx = f->next;
+        src_free(f);
+        f = nx;
+    }
+    src_head = NULL;
+}
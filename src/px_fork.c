@@ -0,0 +1,308 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "px_internal.h"
+#include "zend_exceptions.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * copy-on-writeなforkでクロージャをそのまま子プロセスで実行するモード。
+ * ソース抽出も引数のserializeもしない(親のヒープがそのまま見える)。
+ * 子は結果だけを通常のworkerと同じフレーム形式でパイプに書いて _exit する。
+ * 受信側は px_worker の受信バッファ/フレーム抽出をそのまま使う
+ */
+
+typedef struct px_fork_job {
+    pid_t pid;
+    unsigned long task_id;
+    zval *callback;
+    uint64_t submit_ns;
+    int finished; /* 結果を配り終えてreap待ち */
+    px_worker w;  /* from_child / recv_buf のみ使う */
+    struct px_fork_job *next;
+} px_fork_job;
+
+static px_fork_job *fork_head = NULL;
+static int fork_running = 0;
+int px_fork_max = PX_FORK_DEFAULT_MAX;
+
+int px_fork_active(void) {
+    return fork_running;
+}
+
+static void write_frame(int fd, const char *data, size_t len) {
+    uint32_t be = htonl((uint32_t) len);
+    char hdr[4];
+    memcpy(hdr, &be, 4);
+    const char *parts[2] = {hdr, data};
+    size_t sizes[2] = {4, len};
+    for (int i = 0; i < 2; ++i) {
+        size_t off = 0;
+        while (off < sizes[i]) {
+            ssize_t n = write(fd, parts[i] + off, sizes[i] - off);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return;
+            }
+            off += (size_t) n;
+        }
+    }
+}
+
+static void child_result(int fd, unsigned long tid, int success, zval *data) {
+    zval out;
+    array_init(&out);
+    add_assoc_long(&out, "task_id", (zend_long) tid);
+    add_assoc_bool(&out, "success", success);
+    Z_TRY_ADDREF_P(data);
+    add_assoc_zval(&out, "data", data);
+
+    smart_str buf = {0};
+    if (php_json_encode(&buf, &out, 0) == SUCCESS && buf.s && ZSTR_LEN(buf.s) <= PARALLELX_MAX_MESSAGE) {
+        write_frame(fd, ZSTR_VAL(buf.s), ZSTR_LEN(buf.s));
+    } else {
+        char tmp[128];
+        int n = snprintf(tmp, sizeof(tmp), "{\"task_id\":%lu,\"success\":false,\"data\":\"result too large or not encodable\"}", tid);
+        write_frame(fd, tmp, (size_t) n);
+    }
+    smart_str_free(&buf);
+    zval_ptr_dtor(&out);
+}
+
+static int call_named(const char *name, zval *ret, uint32_t argc, zval *argv) {
+    zval fn;
+    ZVAL_STRING(&fn, name);
+    int rc = call_user_function(NULL, NULL, &fn, ret, argc, argv);
+    zval_ptr_dtor(&fn);
+    return rc;
+}
+
+/* 子プロセス側: workerスクリプトと同じ ['return'=>..., 'output'=>...] 形式で返す */
+static void child_run(int fd, unsigned long tid, zval *task, zval *args) {
+    zend_try {
+        zval ret, tmp, params[2];
+        ZVAL_UNDEF(&ret);
+        ZVAL_UNDEF(&tmp);
+        call_named("ob_start", &tmp, 0, NULL);
+        zval_ptr_dtor(&tmp);
+
+        ZVAL_COPY_VALUE(&params[0], task);
+        ZVAL_COPY_VALUE(&params[1], args);
+        int rc = call_named("call_user_func_array", &ret, 2, params);
+
+        zval output;
+        ZVAL_UNDEF(&output);
+        if (EG(exception)) {
+            zval ex, msg, fn, text;
+            ZVAL_OBJ_COPY(&ex, EG(exception));
+            zend_clear_exception();
+            while (call_named("ob_get_level", &tmp, 0, NULL) == SUCCESS && Z_TYPE(tmp) == IS_LONG && Z_LVAL(tmp) > 0) {
+                call_named("ob_end_clean", &tmp, 0, NULL);
+                zval_ptr_dtor(&tmp);
+            }
+            ZVAL_UNDEF(&msg);
+            if (zend_is_unwind_exit(Z_OBJ(ex))) {
+                /* exit() はgetMessage()を持たない内部オブジェクトとして届く */
+                ZVAL_STRING(&text, "task called exit()");
+            } else {
+                ZVAL_STRING(&fn, "getMessage");
+                call_user_function(NULL, &ex, &fn, &msg, 0, NULL);
+                zval_ptr_dtor(&fn);
+                ZVAL_STR(&text, zend_strpprintf(0, "exception: %s", Z_TYPE(msg) == IS_STRING ? Z_STRVAL(msg) : ""));
+            }
+            child_result(fd, tid, 0, &text);
+            zval_ptr_dtor(&text);
+            zval_ptr_dtor(&msg);
+            zval_ptr_dtor(&ex);
+        } else if (rc != SUCCESS) {
+            zval text;
+            ZVAL_STRING(&text, "task is not callable");
+            child_result(fd, tid, 0, &text);
+            zval_ptr_dtor(&text);
+        } else {
+            call_named("ob_get_clean", &output, 0, NULL);
+            zval pack, ser, b64;
+            array_init(&pack);
+            add_assoc_zval(&pack, "return", &ret);
+            ZVAL_UNDEF(&ret);
+            add_assoc_zval(&pack, "output", &output);
+            ZVAL_UNDEF(&output);
+            call_named("serialize", &ser, 1, &pack);
+            call_named("base64_encode", &b64, 1, &ser);
+            child_result(fd, tid, 1, &b64);
+            zval_ptr_dtor(&b64);
+            zval_ptr_dtor(&ser);
+            zval_ptr_dtor(&pack);
+        }
+        if (!Z_ISUNDEF(ret)) zval_ptr_dtor(&ret);
+    } zend_catch {
+        zval text;
+        ZVAL_STRING(&text, "fatal error in fork child");
+        child_result(fd, tid, 0, &text);
+        zval_ptr_dtor(&text);
+    } zend_end_try();
+}
+
+/* 親から継承したworkerのパイプ/ソケットやほかのfork子のパイプは触らないよう閉じる */
+static void child_close_inherited(void) {
+    for (int i = 0; i < px_worker_count; ++i) {
+        if (workers[i].thread) continue;
+        if (workers[i].to_child >= 0) close(workers[i].to_child);
+        if (workers[i].from_child >= 0) close(workers[i].from_child);
+    }
+    for (px_fork_job *j = fork_head; j; j = j->next) {
+        if (j->w.from_child >= 0) close(j->w.from_child);
+    }
+}
+
+zend_result px_fork_submit(unsigned long tid, zval *task, zval *args, zval *callback) {
+    int fds[2];
+    if (pipe(fds) < 0) return FAILURE;
+
+    px_fork_job *job = (px_fork_job *) calloc(1, sizeof(px_fork_job));
+    if (!job) {
+        close(fds[0]);
+        close(fds[1]);
+        return FAILURE;
+    }
+
+    /* 子の出力バッファに親の未出力分が残らないようにしておく */
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        free(job);
+        return FAILURE;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        signal(SIGPIPE, SIG_DFL);
+        child_close_inherited();
+        child_run(fds[1], tid, task, args);
+        close(fds[1]);
+        /* PHPのshutdown(デストラクタ、出力のflush)を親の状態で走らせない */
+        _exit(0);
+    }
+
+    close(fds[1]);
+    int flags = fcntl(fds[0], F_GETFL, 0);
+    if (flags >= 0) (void) fcntl(fds[0], F_SETFL, flags | O_NONBLOCK);
+
+    job->pid = pid;
+    job->task_id = tid;
+    job->submit_ns = px_now_ns();
+    job->w.pid = pid;
+    job->w.to_child = -1;
+    job->w.from_child = fds[0];
+    job->callback = (zval *) emalloc(sizeof(zval));
+    ZVAL_COPY(job->callback, callback);
+    job->next = fork_head;
+    fork_head = job;
+    fork_running++;
+    px_trace_record(PX_TRACE_SUBMIT, tid, -1, job->submit_ns, 0);
+    return SUCCESS;
+}
+
+static void job_deliver(px_fork_job *job, zval *result) {
+    uint64_t cb_ns = px_now_ns();
+    px_invoke_callback(job->callback, result);
+    uint64_t cb_end_ns = px_now_ns();
+    px_hist_record(&px_stats.callback, (cb_end_ns - cb_ns) / 1000);
+    px_hist_record(&px_stats.end_to_end, (cb_end_ns - job->submit_ns) / 1000);
+    px_trace_record(PX_TRACE_CALLBACK, job->task_id, -1, cb_ns, cb_end_ns - cb_ns);
+}
+
+static void job_fail(px_fork_job *job, const char *message) {
+    zval result;
+    array_init(&result);
+    add_assoc_long(&result, "task_id", (zend_long) job->task_id);
+    add_assoc_bool(&result, "success", 0);
+    add_assoc_string(&result, "data", (char *) message);
+    job_deliver(job, &result);
+    zval_ptr_dtor(&result);
+    px_stats.tasks_failed++;
+}
+
+static void job_finish(px_fork_job *job) {
+    if (job->w.from_child >= 0) close(job->w.from_child);
+    job->w.from_child = -1;
+    free(job->w.recv_buf);
+    job->w.recv_buf = NULL;
+    job->w.recv_used = job->w.recv_cap = 0;
+    if (job->callback) {
+        zval_ptr_dtor(job->callback);
+        efree(job->callback);
+        job->callback = NULL;
+    }
+    job->finished = 1;
+    fork_running--;
+}
+
+/* parallelx_poll から: 結果の届いた子のcallbackを呼び、終了した子をreapする */
+void px_fork_poll(void) {
+    px_fork_job **pp = &fork_head;
+    while (*pp) {
+        px_fork_job *job = *pp;
+
+        if (!job->finished) {
+            px_read_from_worker(&job->w);
+            char *payload = NULL;
+            size_t payload_len = 0;
+            int ex = px_try_extract(&job->w, &payload, &payload_len);
+            if (ex > 0) {
+                zval result;
+                if (px_decode_worker_json(payload, payload_len, &result) == SUCCESS && Z_TYPE(result) == IS_ARRAY) {
+                    job_deliver(job, &result);
+                    px_stats.tasks_completed++;
+                } else {
+                    px_stats.decode_errors++;
+                    job_fail(job, "json_decode failed");
+                }
+                zval_ptr_dtor(&result);
+                free(payload);
+                job_finish(job);
+            } else if (ex < 0) {
+                px_stats.protocol_errors++;
+                job_fail(job, "protocol error");
+                kill(job->pid, SIGKILL);
+                job_finish(job);
+            } else if (job->w.dead) {
+                job_fail(job, "fork child exited without result");
+                job_finish(job);
+            }
+        }
+
+        if (job->finished && waitpid(job->pid, NULL, WNOHANG) != 0) {
+            *pp = job->next;
+            free(job);
+            continue;
+        }
+        pp = &job->next;
+    }
+}
+
+void px_fork_shutdown(void) {
+    px_fork_job *job = fork_head;
+    while (job) {
+        px_fork_job *nx = job->next;
+        if (!job->finished) {
+            kill(job->pid, SIGKILL);
+            job_finish(job);
+        }
+        waitpid(job->pid, NULL, 0);
+        free(job);
+        job = nx;
+    }
+    fork_head = NULL;
+    fork_running = 0;
+}
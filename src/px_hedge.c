@@ -0,0 +1,152 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "px_internal.h"
+
+#include <stdlib.h>
+
+/*
+ * hedged execution。hedge指定のタスクが閾値(固定ms または tokenのp95)を過ぎても終わらなければ
+ * 空いているworkerに同じフレームを送り、先に返った結果だけをcallbackへ渡す。
+ * 負けた側は走り切らせて結果を捨てる(workerを止めると作り直しの方が高くつく)
+ */
+
+typedef struct px_hedge {
+    unsigned long task_id;
+    char *payload; /* emalloc。hedgeを送るまで保持 */
+    size_t payload_len;
+    uint64_t submit_ns;
+    uint64_t deadline_ns;
+    px_worker *hedge; /* 送ったworker。NULLなら未送信 */
+    px_owner *owner;
+    px_hist *exec_hist;
+    px_usage *usage;
+    int copies;  /* 実行中のコピー数 */
+    int settled; /* 結果をcallbackへ渡し済み */
+    struct px_hedge *next;
+} px_hedge;
+
+static px_hedge *hedge_head = NULL;
+
+static px_hedge *hedge_find(unsigned long tid) {
+    for (px_hedge *h = hedge_head; h; h = h->next) {
+        if (h->task_id == tid) return h;
+    }
+    return NULL;
+}
+
+static void hedge_release_payload(px_hedge *h) {
+    if (h->payload) efree(h->payload);
+    h->payload = NULL;
+}
+
+static void hedge_remove(px_hedge *h) {
+    px_hedge **pp = &hedge_head;
+    while (*pp) {
+        if (*pp == h) {
+            *pp = h->next;
+            break;
+        }
+        pp = &(*pp)->next;
+    }
+    hedge_release_payload(h);
+    free(h);
+}
+
+/* 閾値(us)。p95指定でサンプルが足りなければプール全体のp95、それも無ければhedgeしない */
+static uint64_t hedge_threshold_us(const pending_node *n) {
+    if (n->hedge_us > 0) return (uint64_t) n->hedge_us;
+    if (n->exec_hist && n->exec_hist->count >= PX_HEDGE_MIN_SAMPLES) return px_hist_percentile(n->exec_hist, 95.0);
+    if (px_stats.execution.count >= PX_HEDGE_MIN_SAMPLES) return px_hist_percentile(&px_stats.execution, 95.0);
+    return 0;
+}
+
+/* dispatch直後に呼ぶ。hedge対象ならpayloadの所有権をもらう */
+void px_hedge_track(pending_node *n) {
+    if (n->hedge_us == 0) return;
+    uint64_t threshold = hedge_threshold_us(n);
+    if (threshold == 0) return;
+    px_hedge *h = (px_hedge *) calloc(1, sizeof(px_hedge));
+    if (!h) return;
+    h->task_id = n->task_id;
+    h->payload = n->payload;
+    h->payload_len = n->payload_len;
+    h->submit_ns = n->submit_ns;
+    h->deadline_ns = px_now_ns() + threshold * 1000;
+    h->owner = n->owner;
+    h->exec_hist = n->exec_hist;
+    h->usage = n->usage;
+    h->copies = 1;
+    h->next = hedge_head;
+    hedge_head = h;
+    n->payload = NULL;
+}
+
+/* 1: 既に結果を渡したタスクの負けた側なので捨てる */
+int px_hedge_on_result(unsigned long tid, px_worker *w) {
+    if (!hedge_head) return 0;
+    px_hedge *h = hedge_find(tid);
+    if (!h) return 0;
+    h->copies--;
+    if (h->settled) {
+        if (h->copies <= 0) hedge_remove(h);
+        return 1;
+    }
+    h->settled = 1;
+    if (h->hedge && w == h->hedge) px_stats.hedges_won++;
+    hedge_release_payload(h);
+    if (h->copies <= 0) hedge_remove(h);
+    return 0;
+}
+
+/* 1: ほかのコピーがまだ走っている(または結果を渡し済み)ので失敗を通知しない */
+int px_hedge_on_fail(unsigned long tid) {
+    if (!hedge_head) return 0;
+    px_hedge *h = hedge_find(tid);
+    if (!h) return 0;
+    h->copies--;
+    if (h->settled || h->copies > 0) {
+        if (h->copies <= 0) hedge_remove(h);
+        return 1;
+    }
+    hedge_remove(h);
+    return 0;
+}
+
+/* parallelx_pollの最後(待ち行列を流した後)に呼ぶ。空いているworkerだけを使う */
+void px_hedge_launch_due(void) {
+    if (!hedge_head) return;
+    uint64_t now = px_now_ns();
+    for (px_hedge *h = hedge_head; h; h = h->next) {
+        if (h->hedge || h->settled || !h->payload || now < h->deadline_ns) continue;
+        /* 複製もownerの同時実行数の上限に数える */
+        if (h->owner && !px_owner_has_slot(h->owner)) continue;
+        px_worker *w = px_find_idle_worker();
+        if (!w) return;
+        pending_node copy = {0};
+        copy.task_id = h->task_id;
+        copy.payload = h->payload;
+        copy.payload_len = h->payload_len;
+        copy.submit_ns = h->submit_ns;
+        copy.owner = h->owner;
+        copy.exec_hist = h->exec_hist;
+        copy.usage = h->usage;
+        if (px_dispatch_node(w, &copy) != 0) continue;
+        h->hedge = w;
+        h->copies++;
+        hedge_release_payload(h);
+        px_stats.hedges_launched++;
+    }
+}
+
+void px_hedge_free_all(void) {
+    px_hedge *h = hedge_head;
+    while (h) {
+        px_hedge *nx = h->next;
+        hedge_release_payload(h);
+        free(h);
+        h = nx;
+    }
+    hedge_head = NULL;
+}
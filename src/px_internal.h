@@ -10,11 +10,66 @@
 #include <stddef.h>
 #include <limits.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 
 #define PARALLELX_MAX_WORKERS 64
 #define PARALLELX_MAX_MESSAGE (8 * 1024 * 1024)
+#define PX_PIPE_SIZE (1024 * 1024)
+#define PX_NATIVE_PREFIX "native:"
+#define PX_NATIVE_MAX_THREADS 8
+#define PX_NATIVE_MAX_NOISE (16 * 1024 * 1024)
 #define WORKER_TEMPLATE "/var/tmp/parallelx_worker_XXXXXXphp"
 #define ENV_AUTLOAD "PARALLELX_AUTOLOAD"
+#define PARALLELX_MAX_SHM (256 * 1024 * 1024)
+#define SHM_TEMPLATE "/dev/shm/parallelx_shm_XXXXXX"
+#define PX_FORK_DEFAULT_MAX 4
+#define PX_FORK_MAX 64
+#define PX_MEMO_BUCKETS 256
+#define PX_MEMO_DEFAULT_BYTES (4 * 1024 * 1024)
+#define PX_OWNER_DEFAULT "default"
+#define PX_HEDGE_MIN_SAMPLES 20
+#define PX_REMOTE_CONNECT_MS 1000
+#define PX_THREAD_STOP_MS 2000
+#define PX_REMOTE_RETRY_MS 1000
+#define PX_REMOTE_HELLO_MAX 1024
+#define PX_REGISTRY_SALT_MAX 16
+#define PX_OWNER_MAX_WEIGHT 1000
+
+/* log-linear histogram: 2^SUB_BITS sub-buckets per power of two, values in microseconds */
+#define PX_HIST_SUB_BITS 4
+#define PX_HIST_SUB (1 << PX_HIST_SUB_BITS)
+#define PX_HIST_MAGNITUDES 36
+#define PX_HIST_BUCKETS ((PX_HIST_MAGNITUDES + 1) * PX_HIST_SUB)
+
+typedef enum px_backend {
+    PX_BACKEND_PROCESS,
+    PX_BACKEND_THREAD,
+} px_backend;
+
+typedef struct px_thread_slot px_thread_slot;
+typedef struct px_memo px_memo;
+typedef struct px_owner px_owner;
+typedef struct px_hist px_hist;
+typedef struct px_usage px_usage;
+
+/* parallelx_add_remote() で接続したworker daemon */
+typedef struct px_remote {
+    char *address; /* unix:///path | tcp://host:port */
+    int slots;
+    char *auth;    /* 接続直後に送るauthフレーム(長さ付き) */
+    size_t auth_len;
+    struct sockaddr_storage addr; /* 最初に接続できたアドレス。再接続ではDNSを引き直さない */
+    socklen_t addr_len;
+    struct px_remote *next;
+} px_remote;
+
+/* px_memo_lookup の結果 */
+enum {
+    PX_MEMO_MISS_UNTRACKED = 0, /* 通常どおり投げる(memo無効 or 確保失敗) */
+    PX_MEMO_MISS,               /* 通常どおり投げる。このtaskがleaderになる */
+    PX_MEMO_HIT,                /* 次のpollでキャッシュから返す */
+    PX_MEMO_COALESCED,          /* 実行中の同一タスクの結果を待つ */
+};
 
 typedef struct px_worker {
     pid_t pid;
@@ -23,9 +78,28 @@ typedef struct px_worker {
     char *recv_buf;
     size_t recv_used;
     size_t recv_cap;
+    char *send_buf; /* 未送信のフレーム(to_childはnon-blocking) */
+    size_t send_len;
+    size_t send_off;
+    size_t send_cap;
     int busy;
     unsigned long current_task_id;
     int dead;
+    uint64_t submit_ns;
+    uint64_t dispatch_ns;
+    px_thread_slot *thread; /* threadバックエンドのときのみ */
+    uint64_t thread_user_us; /* threadバックエンド: 直近のタスクのCPU時間(RUSAGE_THREAD) */
+    uint64_t thread_sys_us;
+    px_owner *owner;        /* 実行中タスクのowner */
+    px_remote *remote;      /* remote slotのときのみ。to_child/from_childは同じソケット */
+    uint64_t retry_ns;      /* remoteの再接続を次に試す時刻(接続中はhelloまでの期限) */
+    int connecting;         /* remoteの再接続中。1: connect待ち 2: hello待ち */
+    px_hist *exec_hist;     /* 実行中タスクのtokenの実行時間(あれば) */
+    px_usage *usage;        /* 実行中タスクのtokenのリソース集計(あれば) */
+    int generation;         /* parallelx_reload() の世代 */
+    int draining;           /* 新しい世代に置き換え中。実行中のタスクが終わったら退役 */
+    int retired;            /* 空きslot。新しい世代のworkerが再利用する */
+    struct pending_node *retry; /* 切り替え待ちの新しい世代に送ったタスクの控え。落ちたらキューへ戻す */
 } px_worker;
 
 typedef struct pending_node {
@@ -33,34 +107,168 @@ typedef struct pending_node {
     char *payload;
     size_t payload_len;
     zval *callback;
+    uint64_t submit_ns;
+    px_owner *owner;
+    px_hist *exec_hist;
+    px_usage *usage;
+    int64_t hedge_us; /* 0: hedgeしない, -1: tokenのp95 */
     struct pending_node *next;
 } pending_node;
 
+/* submitのoptions配列を解釈した結果 */
+typedef struct px_task_opts {
+    px_owner *owner;
+    px_hist *exec_hist;
+    px_usage *usage;
+    int64_t hedge_us;
+} px_task_opts;
+
 typedef struct running_node {
     unsigned long task_id;
     zval *callback;
     struct running_node *next;
 } running_node;
 
+/* workerが結果フレームの "ru" で申告したタスクごとのリソース使用量をtoken単位で足し込む */
+struct px_usage {
+    uint64_t tasks;
+    uint64_t wall_us;
+    uint64_t user_us;
+    uint64_t sys_us;
+    uint64_t mem_peak_sum;
+    uint64_t mem_peak_max;
+};
+
 typedef struct closure_entry {
     char *token;
     char *source;
     char *bound_b64;
+    px_memo *memo; /* parallelx_memoize() されたときのみ */
+    px_hist *exec_hist; /* hedgeのp95用。最初のsubmitで確保 */
+    px_usage usage;
+    zval batch_cb;      /* parallelx_set_batch_callback()。未設定なら IS_UNDEF */
+    zval batch;         /* 今回のpollで届いた結果 task_id => result */
+    struct closure_entry *batch_next;
     struct closure_entry *next;
 } closure_entry;
 
+typedef enum px_shm_type {
+    PX_SHM_INT8,
+    PX_SHM_UINT8,
+    PX_SHM_INT32,
+    PX_SHM_FLOAT,
+} px_shm_type;
+
+typedef struct px_shm_buffer {
+    zend_long id;
+    char path[PATH_MAX];
+    px_shm_type type;
+    size_t elem_size;
+    size_t length;
+    size_t size;
+    void *addr;
+    struct px_shm_buffer *next;
+} px_shm_buffer;
+
+struct px_hist {
+    uint64_t counts[PX_HIST_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+};
+
+/* submitのowner(プラグインなど)ごとのサブキュー。dispatcherはweight単位でラウンドロビンする */
+struct px_owner {
+    char *name;
+    int weight;
+    int max_inflight; /* 0: 無制限 */
+    int inflight;
+    int deficit;
+    pending_node *head;
+    pending_node *tail;
+    uint64_t depth;
+    uint64_t submitted;
+    uint64_t completed; /* 結果が返ったタスク(success:falseを含む) */
+    uint64_t failed;    /* workerが落ちる等で結果が返らなかったタスク */
+    px_hist queue_wait;
+    struct px_owner *next;
+};
+
+typedef struct px_worker_stats {
+    uint64_t tasks;
+    uint64_t busy_ns;
+    uint64_t restarts;
+} px_worker_stats;
+
+typedef struct px_stats_counters {
+    uint64_t started_ns;
+    uint64_t queue_depth;
+    uint64_t queue_peak;
+    uint64_t tasks_submitted;
+    uint64_t tasks_completed;
+    uint64_t tasks_failed;
+    uint64_t callback_not_found;
+    uint64_t decode_errors;
+    uint64_t protocol_errors;
+    uint64_t worker_restarts;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t frames_sent;
+    uint64_t frames_received;
+    uint64_t encode_count;
+    uint64_t encode_ns;
+    uint64_t decode_count;
+    uint64_t decode_ns;
+    uint64_t memo_hits;
+    uint64_t memo_misses;
+    uint64_t memo_coalesced;
+    uint64_t memo_evictions;
+    uint64_t memo_bytes;
+    uint64_t hedges_launched;
+    uint64_t hedges_won;
+    px_hist queue_wait;
+    px_hist execution;
+    px_hist end_to_end;
+    px_hist callback;
+    px_worker_stats workers[PARALLELX_MAX_WORKERS];
+} px_stats_counters;
+
+typedef enum px_trace_kind {
+    PX_TRACE_SUBMIT,
+    PX_TRACE_ENCODE,
+    PX_TRACE_QUEUE,
+    PX_TRACE_DISPATCH,
+    PX_TRACE_EXECUTE,
+    PX_TRACE_RECEIVE,
+    PX_TRACE_DECODE,
+    PX_TRACE_CALLBACK,
+} px_trace_kind;
+
+typedef struct px_trace_event {
+    unsigned long task_id;
+    uint64_t start_ns;
+    uint64_t dur_ns;
+    px_trace_kind kind;
+    int lane; /* -1: main, 0..: worker index */
+} px_trace_event;
+
 /* global state (defined in src/parallelx.c) */
 extern px_worker *workers;
 extern int px_worker_count;
 extern int px_initialized;
+extern px_backend px_active_backend;
 extern char worker_script_path[PATH_MAX];
 extern char php_cli_path[PATH_MAX];
 extern unsigned long next_task_id;
+extern int px_generation;
 
-extern pending_node *pending_head;
-extern pending_node *pending_tail;
+extern px_owner *owner_head;
 extern running_node *running_head;
 extern closure_entry *closure_head;
+extern px_stats_counters px_stats;
+extern int px_trace_enabled;
+extern int px_fork_max;
 
 /* json */
 zend_result px_encode_descriptor_with_task(zval *desc, unsigned long tid, char **out, size_t *out_len);
@@ -69,25 +277,132 @@ zend_result px_decode_worker_json(const char *payload, size_t len, zval *out);
 /* queue/callback */
 void px_invoke_callback(zval *cb, zval *assoc);
 void px_fail_task(unsigned long tid, const char *message);
+void px_worker_abandon(px_worker *w, const char *message);
 zval *px_running_pop(unsigned long id);
-zend_result px_enqueue_payload(unsigned long tid, char *payload, size_t payload_len, zval *callback);
+int px_dispatch_node(px_worker *w, pending_node *n);
+zend_result px_enqueue_payload(unsigned long tid, char *payload, size_t payload_len, zval *callback, const px_task_opts *opts);
 void px_dispatch_pending_to_idle(void);
 void px_queue_free_all(void);
 
+/* hedged execution */
+void px_hedge_track(pending_node *n);
+int px_hedge_on_result(unsigned long tid, px_worker *w);
+int px_hedge_on_fail(unsigned long tid);
+void px_hedge_launch_due(void);
+void px_hedge_free_all(void);
+
+/* per-token resource usage */
+void px_usage_record(px_worker *w, zval *result);
+void px_usage_to_array(px_usage *u, zval *out);
+
+/* batch delivery (callbackなしのタスク) */
+void px_batch_target(closure_entry *e, zval *out);
+void px_batch_collect(zval *cb, zval *assoc);
+void px_batch_flush(void);
+void px_batch_set_callback(closure_entry *e, zval *cb);
+void px_batch_take(zend_long max, zval *out);
+zend_long px_batch_pending(void);
+void px_batch_free_all(void);
+
+/* owners (fair queueing) */
+px_owner *px_owner_get(const char *name);
+int px_owner_has_slot(const px_owner *o);
+int px_owner_from_options(zval *options, px_owner **out);
+void px_owner_stats_reset(void);
+void px_owner_stats_to_array(zval *out);
+void px_owner_free_all(void);
+
 /* registry */
 closure_entry *px_registry_find(const char *token);
 char *px_registry_insert(const char *source, const char *bound_b64);
+char *px_registry_insert_named(const char *token, const char *source, const char *bound_b64);
+
+/* closure capture (parallelx_register_closure) */
+char *px_closure_register(zval *closure, const char **err);
+void px_closure_free_all(void);
 void px_registry_free_all(void);
 
+/* memo / single-flight */
+px_memo *px_memo_create(void);
+void px_memo_configure(px_memo *m, int enabled, uint64_t ttl_ns, size_t max_bytes);
+void px_memo_destroy(px_memo *m);
+int px_memo_lookup(px_memo *m, const char *token, const char *args, size_t args_len, unsigned long tid, zval *callback);
+void px_memo_complete(unsigned long tid, const char *payload, size_t payload_len, zval *result);
+void px_memo_fail(unsigned long tid, const char *message);
+void px_memo_drain(void);
+void px_memo_free_all(void);
+
+/* shared memory buffers */
+int px_shm_type_from_name(const char *name, px_shm_type *type, size_t *elem_size);
+const char *px_shm_type_name(px_shm_type type);
+px_shm_buffer *px_shm_alloc(px_shm_type type, size_t elem_size, size_t length);
+px_shm_buffer *px_shm_find(zend_long id);
+int px_shm_free(zend_long id);
+void px_shm_handle(px_shm_buffer *b, zval *out);
+void px_shm_to_array(px_shm_buffer *b, zval *out);
+void px_shm_free_all(void);
+
+/* stats */
+uint64_t px_now_ns(void);
+void px_hist_record(px_hist *h, uint64_t value_us);
+uint64_t px_hist_percentile(const px_hist *h, double pct);
+void px_hist_to_array(const px_hist *h, zval *out);
+void px_stats_reset(void);
+void px_stats_on_dispatch(px_worker *w, uint64_t submit_ns);
+void px_stats_on_complete(px_worker *w, uint64_t recv_ns);
+void px_stats_to_array(zval *out);
+
+/* trace */
+int px_trace_enable(size_t capacity);
+void px_trace_disable(void);
+void px_trace_record(px_trace_kind kind, unsigned long tid, int lane, uint64_t start_ns, uint64_t dur_ns);
+uint64_t px_trace_from_wall(double wall_seconds);
+long px_trace_dump(const char *path);
+
 /* worker/process */
 int px_create_worker_script_if_missing(const char *user_script);
 int px_spawn_workers(int count);
 px_worker *px_find_idle_worker(void);
+void px_worker_release(px_worker *w);
 int px_send_to_worker(px_worker *w, const char *json, size_t len, unsigned long tid);
+int px_flush_worker(px_worker *w);
 int px_assign_pending(px_worker *w);
 void px_read_from_worker(px_worker *w);
 int px_try_extract(px_worker *w, char **payload_out, size_t *len_out);
 int px_restart_worker(int idx);
+int px_worker_free_slots(void);
+int px_spawn_generation(int count);
+void px_worker_retire(px_worker *w);
+void px_reload_begin(const char *old_cli, const char *old_script, char *old_autoload);
+int px_reload_pending(void);
+void px_reload_confirm(px_worker *w);
+int px_reload_unconfirmed(const px_worker *w);
+void px_reload_free(void);
+void px_worker_reap(int block);
+
+/* thread backend (ZTS only) */
+int px_spawn_threads(int count);
+int px_thread_send(px_worker *w, const char *json, size_t len, unsigned long tid);
+void px_thread_collect(px_worker *w);
+void px_thread_shutdown_all(void);
+
+/* fork mode (Linux only) */
+zend_result px_fork_submit(unsigned long tid, zval *task, zval *args, zval *callback);
+int px_fork_active(void);
+void px_fork_poll(void);
+void px_fork_shutdown(void);
+
+/* remote worker daemons */
+int px_remote_add(const char *address, int max_slots, const char *secret, char *err, size_t err_len);
+int px_remote_reconnect(px_worker *w);
+int px_remote_poll_connect(px_worker *w);
+void px_remote_free_all(void);
+
+/* native kernels */
+int px_native_is_native_type(const char *type);
+zend_result px_native_submit(unsigned long tid, const char *type, zval *desc, zval *callback);
+void px_native_drain(void);
+void px_native_shutdown(void);
 
 /* misc */
 char *px_strdup(const char *s);
@@ -5,18 +5,24 @@
 #include "px_internal.h"
 
 zend_result px_encode_descriptor_with_task(zval *desc, unsigned long tid, char **out, size_t *out_len) {
+    uint64_t start_ns = px_now_ns();
     add_assoc_long(desc, "task_id", (zend_long) tid);
+    /* 呼び出し側が持っているtraceキーは触らない(descはその場でencodeしている) */
+    int added_trace = px_trace_enabled && !zend_hash_str_exists(Z_ARRVAL_P(desc), "trace", sizeof("trace") - 1);
+    if (added_trace) add_assoc_bool(desc, "trace", 1);
 
     smart_str buf = {0};
     if (php_json_encode(&buf, desc, PHP_JSON_PARTIAL_OUTPUT_ON_ERROR) != SUCCESS) {
         smart_str_free(&buf);
         zend_hash_str_del(Z_ARRVAL_P(desc), "task_id", sizeof("task_id") - 1);
+        if (added_trace) zend_hash_str_del(Z_ARRVAL_P(desc), "trace", sizeof("trace") - 1);
         return FAILURE;
     }
 
     smart_str_0(&buf);
     if (!buf.s) {
         zend_hash_str_del(Z_ARRVAL_P(desc), "task_id", sizeof("task_id") - 1);
+        if (added_trace) zend_hash_str_del(Z_ARRVAL_P(desc), "trace", sizeof("trace") - 1);
         return FAILURE;
     }
 
@@ -24,6 +30,7 @@ zend_result px_encode_descriptor_with_task(zval *desc, unsigned long tid, char *
     if (*out_len > PARALLELX_MAX_MESSAGE) {
         smart_str_free(&buf);
         zend_hash_str_del(Z_ARRVAL_P(desc), "task_id", sizeof("task_id") - 1);
+        if (added_trace) zend_hash_str_del(Z_ARRVAL_P(desc), "trace", sizeof("trace") - 1);
         return FAILURE;
     }
 
@@ -32,14 +39,22 @@ zend_result px_encode_descriptor_with_task(zval *desc, unsigned long tid, char *
 
     smart_str_free(&buf);
     zend_hash_str_del(Z_ARRVAL_P(desc), "task_id", sizeof("task_id") - 1);
+    if (added_trace) zend_hash_str_del(Z_ARRVAL_P(desc), "trace", sizeof("trace") - 1);
+    uint64_t end_ns = px_now_ns();
+    px_stats.encode_count++;
+    px_stats.encode_ns += end_ns - start_ns;
+    px_trace_record(PX_TRACE_ENCODE, tid, -1, start_ns, end_ns - start_ns);
     return SUCCESS;
 }
 
 zend_result px_decode_worker_json(const char *payload, size_t len, zval *out) {
+    uint64_t start_ns = px_now_ns();
     ZVAL_UNDEF(out);
     if (php_json_decode_ex(out, (char *) payload, len, PHP_JSON_OBJECT_AS_ARRAY, PHP_JSON_PARSER_DEFAULT_DEPTH) != SUCCESS) {
         return FAILURE;
     }
+    px_stats.decode_count++;
+    px_stats.decode_ns += px_now_ns() - start_ns;
     return SUCCESS;
 }
 
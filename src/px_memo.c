@@ -0,0 +1,383 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "px_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * tokenごとのopt-inな結果メモ化とsingle-flight。
+ * key = hash(token + encode済みargs)。同じkeyのタスクが実行中なら新たに投げずに待ち合わせ、
+ * 1回の実行結果を全callbackへ配る。成功した結果はTTLとバイト上限の範囲でキャッシュし、
+ * ヒットは次のparallelx_pollでworkerに触れずに返す
+ */
+
+typedef struct px_memo_waiter {
+    unsigned long task_id;
+    zval *callback;
+    struct px_memo_waiter *next;
+} px_memo_waiter;
+
+typedef struct px_memo_entry {
+    uint64_t hash;
+    char *args;
+    size_t args_len;
+    int ready;
+    unsigned long leader_tid; /* ready == 0 の間のみ有効 */
+    uint64_t expires_ns;
+    char *result;
+    size_t result_len;
+    px_memo_waiter *waiters;
+    px_memo *memo;
+    struct px_memo_entry *next;      /* bucket chain */
+    struct px_memo_entry *age_next;  /* 古い順(ready のみ) */
+    struct px_memo_entry *flight_next;
+} px_memo_entry;
+
+struct px_memo {
+    int enabled;
+    uint64_t ttl_ns; /* 0: キャッシュせずsingle-flightのみ */
+    size_t max_bytes;
+    size_t bytes;
+    px_memo_entry *buckets[PX_MEMO_BUCKETS];
+    px_memo_entry *age_head;
+    px_memo_entry *age_tail;
+};
+
+typedef struct px_memo_ready {
+    unsigned long task_id;
+    zval *callback;
+    char *payload;
+    size_t payload_len;
+    struct px_memo_ready *next;
+} px_memo_ready;
+
+static px_memo_entry *inflight_head = NULL;
+static px_memo_ready *ready_head = NULL, *ready_tail = NULL;
+
+static uint64_t memo_hash(const char *token, const char *args, size_t args_len) {
+    uint64_t h = 1469598103934665603ULL;
+    for (const char *p = token; *p; ++p) h = (h ^ (uint8_t) *p) * 1099511628211ULL;
+    h = (h ^ 0xff) * 1099511628211ULL;
+    for (size_t i = 0; i < args_len; ++i) h = (h ^ (uint8_t) args[i]) * 1099511628211ULL;
+    return h;
+}
+
+static zval *waiter_callback(zval *callback) {
+    zval *cb = (zval *) emalloc(sizeof(zval));
+    ZVAL_COPY(cb, callback);
+    return cb;
+}
+
+static void free_callback(zval *cb) {
+    if (!cb) return;
+    zval_ptr_dtor(cb);
+    efree(cb);
+}
+
+static void bucket_unlink(px_memo *m, px_memo_entry *e) {
+    px_memo_entry **pp = &m->buckets[e->hash % PX_MEMO_BUCKETS];
+    while (*pp) {
+        if (*pp == e) {
+            *pp = e->next;
+            return;
+        }
+        pp = &(*pp)->next;
+    }
+}
+
+static void age_unlink(px_memo *m, px_memo_entry *e) {
+    px_memo_entry *prev = NULL, *cur = m->age_head;
+    while (cur) {
+        if (cur == e) {
+            if (prev) prev->age_next = cur->age_next;
+            else m->age_head = cur->age_next;
+            if (m->age_tail == cur) m->age_tail = prev;
+            return;
+        }
+        prev = cur;
+        cur = cur->age_next;
+    }
+}
+
+static void flight_unlink(px_memo_entry *e) {
+    px_memo_entry **pp = &inflight_head;
+    while (*pp) {
+        if (*pp == e) {
+            *pp = e->flight_next;
+            return;
+        }
+        pp = &(*pp)->flight_next;
+    }
+}
+
+static void entry_free(px_memo_entry *e) {
+    px_memo_waiter *w = e->waiters;
+    while (w) {
+        px_memo_waiter *nx = w->next;
+        free_callback(w->callback);
+        free(w);
+        w = nx;
+    }
+    free(e->args);
+    free(e->result);
+    free(e);
+}
+
+/* readyなentryをキャッシュから外して解放する */
+static void evict(px_memo *m, px_memo_entry *e) {
+    bucket_unlink(m, e);
+    age_unlink(m, e);
+    m->bytes -= e->args_len + e->result_len;
+    px_stats.memo_bytes -= e->args_len + e->result_len;
+    entry_free(e);
+}
+
+static void evict_expired(px_memo *m, uint64_t now) {
+    while (m->age_head && m->age_head->expires_ns <= now) {
+        evict(m, m->age_head);
+        px_stats.memo_evictions++;
+    }
+}
+
+px_memo *px_memo_create(void) {
+    return (px_memo *) calloc(1, sizeof(px_memo));
+}
+
+/* enabled == 0 にしても実行中のentryは完了まで待ち合わせを配る */
+void px_memo_configure(px_memo *m, int enabled, uint64_t ttl_ns, size_t max_bytes) {
+    m->enabled = enabled;
+    m->ttl_ns = enabled ? ttl_ns : 0;
+    if (!enabled || ttl_ns == 0) max_bytes = 0;
+    m->max_bytes = max_bytes;
+    while (m->age_head && m->bytes > m->max_bytes) {
+        evict(m, m->age_head);
+        px_stats.memo_evictions++;
+    }
+}
+
+void px_memo_destroy(px_memo *m) {
+    if (!m) return;
+    for (int b = 0; b < PX_MEMO_BUCKETS; ++b) {
+        px_memo_entry *e = m->buckets[b];
+        while (e) {
+            px_memo_entry *nx = e->next;
+            if (e->ready) {
+                px_stats.memo_bytes -= e->args_len + e->result_len;
+            } else {
+                /* 実行中のentryは結果が来ても配れないので待ち合わせ中のcallbackごと捨てる */
+                flight_unlink(e);
+            }
+            entry_free(e);
+            e = nx;
+        }
+    }
+    free(m);
+}
+
+int px_memo_lookup(px_memo *m, const char *token, const char *args, size_t args_len, unsigned long tid, zval *callback) {
+    if (!m->enabled) return PX_MEMO_MISS_UNTRACKED;
+    evict_expired(m, px_now_ns());
+
+    uint64_t h = memo_hash(token, args, args_len);
+    px_memo_entry *e = m->buckets[h % PX_MEMO_BUCKETS];
+    while (e) {
+        if (e->hash == h && e->args_len == args_len && memcmp(e->args, args, args_len) == 0) break;
+        e = e->next;
+    }
+
+    if (e && e->ready) {
+        px_memo_ready *r = (px_memo_ready *) malloc(sizeof(px_memo_ready));
+        char *copy = (char *) malloc(e->result_len + 1);
+        if (!r || !copy) {
+            free(r);
+            free(copy);
+            return PX_MEMO_MISS_UNTRACKED;
+        }
+        memcpy(copy, e->result, e->result_len + 1);
+        r->task_id = tid;
+        r->callback = waiter_callback(callback);
+        r->payload = copy;
+        r->payload_len = e->result_len;
+        r->next = NULL;
+        if (ready_tail) ready_tail->next = r;
+        else ready_head = r;
+        ready_tail = r;
+        px_stats.memo_hits++;
+        return PX_MEMO_HIT;
+    }
+
+    if (e) {
+        px_memo_waiter *w = (px_memo_waiter *) malloc(sizeof(px_memo_waiter));
+        if (!w) return PX_MEMO_MISS_UNTRACKED;
+        w->task_id = tid;
+        w->callback = waiter_callback(callback);
+        w->next = e->waiters;
+        e->waiters = w;
+        px_stats.memo_coalesced++;
+        return PX_MEMO_COALESCED;
+    }
+
+    px_stats.memo_misses++;
+    e = (px_memo_entry *) calloc(1, sizeof(px_memo_entry));
+    if (!e) return PX_MEMO_MISS_UNTRACKED;
+    e->args = (char *) malloc(args_len + 1);
+    if (!e->args) {
+        free(e);
+        return PX_MEMO_MISS_UNTRACKED;
+    }
+    memcpy(e->args, args, args_len);
+    e->args[args_len] = '\0';
+    e->args_len = args_len;
+    e->hash = h;
+    e->leader_tid = tid;
+    e->memo = m;
+    e->next = m->buckets[h % PX_MEMO_BUCKETS];
+    m->buckets[h % PX_MEMO_BUCKETS] = e;
+    e->flight_next = inflight_head;
+    inflight_head = e;
+    return PX_MEMO_MISS;
+}
+
+static px_memo_entry *inflight_take(unsigned long tid) {
+    px_memo_entry **pp = &inflight_head;
+    while (*pp) {
+        px_memo_entry *e = *pp;
+        if (e->leader_tid == tid) {
+            *pp = e->flight_next;
+            e->flight_next = NULL;
+            return e;
+        }
+        pp = &e->flight_next;
+    }
+    return NULL;
+}
+
+static void deliver(zval *callback, zval *result, unsigned long tid) {
+    zval copy;
+    ZVAL_ARR(&copy, zend_array_dup(Z_ARRVAL_P(result)));
+    add_assoc_long(&copy, "task_id", (zend_long) tid);
+    px_invoke_callback(callback, &copy);
+    zval_ptr_dtor(&copy);
+}
+
+void px_memo_complete(unsigned long tid, const char *payload, size_t payload_len, zval *result) {
+    if (!inflight_head) return;
+    px_memo_entry *e = inflight_take(tid);
+    if (!e) return;
+    px_memo *m = e->memo;
+
+    /* 待ち合わせていたcallbackへ同じ結果を配る */
+    px_memo_waiter *w = e->waiters;
+    e->waiters = NULL;
+    while (w) {
+        px_memo_waiter *nx = w->next;
+        deliver(w->callback, result, w->task_id);
+        px_stats.tasks_completed++;
+        free_callback(w->callback);
+        free(w);
+        w = nx;
+    }
+
+    zval *ok = zend_hash_str_find(Z_ARRVAL_P(result), "success", sizeof("success") - 1);
+    size_t size = e->args_len + payload_len;
+    if (!ok || !zend_is_true(ok) || m->ttl_ns == 0 || size > m->max_bytes) {
+        bucket_unlink(m, e);
+        entry_free(e);
+        return;
+    }
+    e->result = (char *) malloc(payload_len + 1);
+    if (!e->result) {
+        bucket_unlink(m, e);
+        entry_free(e);
+        return;
+    }
+    memcpy(e->result, payload, payload_len);
+    e->result[payload_len] = '\0';
+    e->result_len = payload_len;
+    e->ready = 1;
+    e->expires_ns = px_now_ns() + m->ttl_ns;
+    if (m->age_tail) m->age_tail->age_next = e;
+    else m->age_head = e;
+    m->age_tail = e;
+    m->bytes += size;
+    px_stats.memo_bytes += size;
+
+    while (m->bytes > m->max_bytes && m->age_head) {
+        evict(m, m->age_head);
+        px_stats.memo_evictions++;
+    }
+}
+
+void px_memo_fail(unsigned long tid, const char *message) {
+    if (!inflight_head) return;
+    px_memo_entry *e = inflight_take(tid);
+    if (!e) return;
+    px_memo_waiter *w = e->waiters;
+    e->waiters = NULL;
+    while (w) {
+        px_memo_waiter *nx = w->next;
+        zval result;
+        array_init(&result);
+        add_assoc_long(&result, "task_id", (zend_long) w->task_id);
+        add_assoc_bool(&result, "success", 0);
+        add_assoc_string(&result, "data", message ? message : "error");
+        px_invoke_callback(w->callback, &result);
+        zval_ptr_dtor(&result);
+        px_stats.tasks_failed++;
+        free_callback(w->callback);
+        free(w);
+        w = nx;
+    }
+    bucket_unlink(e->memo, e);
+    entry_free(e);
+}
+
+/* キャッシュヒットしたタスクのcallbackを呼ぶ(parallelx_pollから) */
+void px_memo_drain(void) {
+    px_memo_ready *r = ready_head;
+    ready_head = ready_tail = NULL;
+    while (r) {
+        px_memo_ready *nx = r->next;
+        zval result;
+        ZVAL_UNDEF(&result);
+        if (px_decode_worker_json(r->payload, r->payload_len, &result) == SUCCESS && Z_TYPE(result) == IS_ARRAY) {
+            add_assoc_long(&result, "task_id", (zend_long) r->task_id);
+            uint64_t cb_ns = px_now_ns();
+            px_invoke_callback(r->callback, &result);
+            px_hist_record(&px_stats.callback, (px_now_ns() - cb_ns) / 1000);
+            px_stats.tasks_completed++;
+        } else {
+            /* 捨てずに失敗として返す(px_memo_fail と同じ形) */
+            if (!Z_ISUNDEF(result)) zval_ptr_dtor(&result);
+            array_init(&result);
+            add_assoc_long(&result, "task_id", (zend_long) r->task_id);
+            add_assoc_bool(&result, "success", 0);
+            add_assoc_string(&result, "data", "json_decode failed");
+            px_invoke_callback(r->callback, &result);
+            px_stats.decode_errors++;
+            px_stats.tasks_failed++;
+        }
+        if (!Z_ISUNDEF(result)) zval_ptr_dtor(&result);
+        free_callback(r->callback);
+        free(r->payload);
+        free(r);
+        r = nx;
+    }
+}
+
+void px_memo_free_all(void) {
+    px_memo_ready *r = ready_head;
+    while (r) {
+        px_memo_ready *nx = r->next;
+        free_callback(r->callback);
+        free(r->payload);
+        free(r);
+        r = nx;
+    }
+    ready_head = ready_tail = NULL;
+    inflight_head = NULL;
+    /* entry本体は px_registry_free_all から px_memo_destroy で解放される */
+}
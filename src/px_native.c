@@ -0,0 +1,513 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "px_internal.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_PX_ZLIB
+#include <zlib.h>
+#endif
+
+/*
+ * PHPを必要としない処理(圧縮・ハッシュ・ノイズ生成・配列変換)を拡張内のpthreadプールで実行する。
+ * descriptorの type が "native:*" のタスクはJSON化もworkerも通らず、結果は parallelx_poll で
+ * 通常のタスクと同じ ['task_id', 'success', 'data'] 形式でcallbackに渡される
+ */
+
+typedef enum px_native_kind {
+    PX_NATIVE_DEFLATE,
+    PX_NATIVE_CRC32,
+    PX_NATIVE_NOISE2D,
+    PX_NATIVE_F32_AFFINE,
+} px_native_kind;
+
+typedef struct px_native_task {
+    unsigned long task_id;
+    px_native_kind kind;
+    zval *callback; /* メインスレッドからのみ触る */
+    uint64_t submit_ns;
+
+    /* 入力(メインスレッドでmallocにコピー済み) */
+    char *in;
+    size_t in_len;
+    zend_long level;
+    int window_bits;
+    double x, z, scale, persistence, mul, add, lo, hi;
+    int clamp;
+    zend_long width, height, octaves, seed;
+
+    /* 出力 */
+    int success;
+    char *out;
+    size_t out_len;
+    int out_is_long;
+    zend_long out_long;
+    const char *error;
+
+    struct px_native_task *next;
+} px_native_task;
+
+static pthread_mutex_t native_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t native_cond = PTHREAD_COND_INITIALIZER;
+static px_native_task *job_head = NULL, *job_tail = NULL;
+static px_native_task *done_head = NULL, *done_tail = NULL;
+static pthread_t native_threads[PX_NATIVE_MAX_THREADS];
+static int native_thread_count = 0;
+static int native_stopping = 0;
+
+/* -------------------- kernels -------------------- */
+
+static void kernel_deflate(px_native_task *t) {
+#ifdef HAVE_PX_ZLIB
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, (int) t->level, Z_DEFLATED, t->window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        t->error = "deflateInit failed";
+        return;
+    }
+    size_t cap = deflateBound(&zs, (uLong) t->in_len);
+    t->out = (char *) malloc(cap);
+    if (!t->out) {
+        deflateEnd(&zs);
+        t->error = "out of memory";
+        return;
+    }
+    /* avail_in / avail_out はuIntなので4GB以上は分割して渡す */
+    const Bytef *in = (const Bytef *) t->in;
+    size_t in_left = t->in_len;
+    Bytef *out = (Bytef *) t->out;
+    size_t out_left = cap;
+    int rc;
+    do {
+        if (zs.avail_in == 0 && in_left) {
+            uInt n = in_left > 0x40000000U ? 0x40000000U : (uInt) in_left;
+            zs.next_in = (Bytef *) in;
+            zs.avail_in = n;
+            in += n;
+            in_left -= n;
+        }
+        if (zs.avail_out == 0 && out_left) {
+            uInt n = out_left > 0x40000000U ? 0x40000000U : (uInt) out_left;
+            zs.next_out = out;
+            zs.avail_out = n;
+            out += n;
+            out_left -= n;
+        }
+        rc = deflate(&zs, in_left ? Z_NO_FLUSH : Z_FINISH);
+    } while (rc == Z_OK || (rc == Z_BUF_ERROR && (zs.avail_in || in_left) && (zs.avail_out || out_left)));
+    t->out_len = (size_t) zs.total_out;
+    deflateEnd(&zs);
+    if (rc != Z_STREAM_END) {
+        t->error = "deflate failed";
+        return;
+    }
+    t->success = 1;
+#else
+    t->error = "zlib support not compiled in";
+#endif
+}
+
+#ifndef HAVE_PX_ZLIB
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_table_init(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+#endif
+
+static void kernel_crc32(px_native_task *t) {
+#ifdef HAVE_PX_ZLIB
+    uLong crc = crc32(0L, Z_NULL, 0);
+    const Bytef *p = (const Bytef *) t->in;
+    size_t left = t->in_len;
+    /* uInt単位でしか渡せないので分割する */
+    while (left) {
+        uInt n = left > 0x40000000U ? 0x40000000U : (uInt) left;
+        crc = crc32(crc, p, n);
+        p += n;
+        left -= n;
+    }
+    t->out_long = (zend_long) crc;
+#else
+    pthread_once(&crc_once, crc_table_init);
+    uint32_t c = 0xFFFFFFFFU;
+    const uint8_t *p = (const uint8_t *) t->in;
+    for (size_t i = 0; i < t->in_len; ++i) c = crc_table[(c ^ p[i]) & 0xFF] ^ (c >> 8);
+    t->out_long = (zend_long) (c ^ 0xFFFFFFFFU);
+#endif
+    t->out_is_long = 1;
+    t->success = 1;
+}
+
+/* improved Perlin noise (2D)。seedで並べ替え表を作る */
+static void noise_perm(uint8_t perm[512], zend_long seed) {
+    uint64_t s = (uint64_t) seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    for (int i = 0; i < 256; ++i) perm[i] = (uint8_t) i;
+    for (int i = 255; i > 0; --i) {
+        s = s * 6364136223846793005ULL + 1442695040888963407ULL;
+        int j = (int) ((s >> 33) % (uint64_t) (i + 1));
+        uint8_t tmp = perm[i];
+        perm[i] = perm[j];
+        perm[j] = tmp;
+    }
+    memcpy(perm + 256, perm, 256);
+}
+
+static inline double noise_fade(double t) {
+    return t * t * t * (t * (t * 6 - 15) + 10);
+}
+
+static inline double noise_grad(uint8_t h, double x, double y) {
+    switch (h & 7) {
+        case 0: return x + y;
+        case 1: return -x + y;
+        case 2: return x - y;
+        case 3: return -x - y;
+        case 4: return x;
+        case 5: return -x;
+        case 6: return y;
+        default: return -y;
+    }
+}
+
+/* 格子座標を0..255へ。intへのキャストは範囲外/非有限だと未定義なのでfmodで畳む */
+static inline int noise_wrap(double f) {
+    if (!isfinite(f)) return 0;
+    double m = fmod(f, 256.0);
+    if (m < 0) m += 256.0;
+    return (int) m & 255;
+}
+
+static double noise2(const uint8_t *perm, double x, double y) {
+    double fx = floor(x), fy = floor(y);
+    int xi = noise_wrap(fx), yi = noise_wrap(fy);
+    x -= fx;
+    y -= fy;
+    double u = noise_fade(x), v = noise_fade(y);
+    int a = perm[xi] + yi, b = perm[xi + 1] + yi;
+    double n00 = noise_grad(perm[a], x, y);
+    double n10 = noise_grad(perm[b], x - 1, y);
+    double n01 = noise_grad(perm[a + 1], x, y - 1);
+    double n11 = noise_grad(perm[b + 1], x - 1, y - 1);
+    double nx0 = n00 + u * (n10 - n00);
+    double nx1 = n01 + u * (n11 - n01);
+    return nx0 + v * (nx1 - nx0);
+}
+
+static void kernel_noise2d(px_native_task *t) {
+    size_t count = (size_t) t->width * (size_t) t->height;
+    float *out = (float *) malloc(count * sizeof(float));
+    if (!out) {
+        t->error = "out of memory";
+        return;
+    }
+    uint8_t perm[512];
+    noise_perm(perm, t->seed);
+
+    for (zend_long row = 0; row < t->height; ++row) {
+        for (zend_long col = 0; col < t->width; ++col) {
+            double amp = 1.0, freq = t->scale, sum = 0.0, norm = 0.0;
+            for (zend_long o = 0; o < t->octaves; ++o) {
+                sum += amp * noise2(perm, (t->x + (double) col) * freq, (t->z + (double) row) * freq);
+                norm += amp;
+                amp *= t->persistence;
+                freq *= 2.0;
+            }
+            out[row * t->width + col] = (float) (sum / norm);
+        }
+    }
+    t->out = (char *) out;
+    t->out_len = count * sizeof(float);
+    t->success = 1;
+}
+
+/* 分岐のない単純ループにしてコンパイラの自動ベクトル化(SSE/AVX)に任せる */
+static void f32_affine(float *restrict dst, const float *restrict src, size_t n, float mul, float add) {
+    for (size_t i = 0; i < n; ++i) dst[i] = src[i] * mul + add;
+}
+
+static void f32_clamp(float *restrict dst, size_t n, float lo, float hi) {
+    for (size_t i = 0; i < n; ++i) {
+        float v = dst[i];
+        v = v < lo ? lo : v;
+        dst[i] = v > hi ? hi : v;
+    }
+}
+
+static void kernel_f32_affine(px_native_task *t) {
+    if (t->in_len % sizeof(float) != 0) {
+        t->error = "data length is not a multiple of 4";
+        return;
+    }
+    size_t n = t->in_len / sizeof(float);
+    float *out = (float *) malloc(t->in_len ? t->in_len : 1);
+    if (!out) {
+        t->error = "out of memory";
+        return;
+    }
+    /* inはmalloc由来なのでfloatのアラインメントを満たす */
+    f32_affine(out, (const float *) t->in, n, (float) t->mul, (float) t->add);
+    if (t->clamp) f32_clamp(out, n, (float) t->lo, (float) t->hi);
+    t->out = (char *) out;
+    t->out_len = t->in_len;
+    t->success = 1;
+}
+
+static void native_run(px_native_task *t) {
+    switch (t->kind) {
+        case PX_NATIVE_DEFLATE: kernel_deflate(t); break;
+        case PX_NATIVE_CRC32: kernel_crc32(t); break;
+        case PX_NATIVE_NOISE2D: kernel_noise2d(t); break;
+        case PX_NATIVE_F32_AFFINE: kernel_f32_affine(t); break;
+    }
+    free(t->in);
+    t->in = NULL;
+}
+
+/* -------------------- pool -------------------- */
+
+static void *native_thread_main(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&native_lock);
+    while (1) {
+        while (!job_head && !native_stopping) pthread_cond_wait(&native_cond, &native_lock);
+        if (native_stopping) break;
+        px_native_task *t = job_head;
+        job_head = t->next;
+        if (!job_head) job_tail = NULL;
+        pthread_mutex_unlock(&native_lock);
+
+        native_run(t);
+
+        pthread_mutex_lock(&native_lock);
+        t->next = NULL;
+        if (done_tail) done_tail->next = t;
+        else done_head = t;
+        done_tail = t;
+    }
+    pthread_mutex_unlock(&native_lock);
+    return NULL;
+}
+
+static int native_start_pool(void) {
+    if (native_thread_count > 0) return 0;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int n = cpus > 0 ? (int) cpus : 1;
+    if (n > PX_NATIVE_MAX_THREADS) n = PX_NATIVE_MAX_THREADS;
+    native_stopping = 0;
+    for (int i = 0; i < n; ++i) {
+        if (pthread_create(&native_threads[i], NULL, native_thread_main, NULL) != 0) break;
+        native_thread_count++;
+    }
+    return native_thread_count > 0 ? 0 : -1;
+}
+
+/* -------------------- main thread side -------------------- */
+
+static zval *arg_find(HashTable *args, const char *key) {
+    return args ? zend_hash_str_find(args, key, strlen(key)) : NULL;
+}
+
+static zend_long arg_long(HashTable *args, const char *key, zend_long def) {
+    zval *z = arg_find(args, key);
+    return z ? zval_get_long(z) : def;
+}
+
+static double arg_double(HashTable *args, const char *key, double def) {
+    zval *z = arg_find(args, key);
+    return z ? zval_get_double(z) : def;
+}
+
+static int arg_bytes(HashTable *args, const char *key, px_native_task *t) {
+    zval *z = arg_find(args, key);
+    if (!z || Z_TYPE_P(z) != IS_STRING) return -1;
+    t->in_len = Z_STRLEN_P(z);
+    t->in = (char *) malloc(t->in_len ? t->in_len : 1);
+    if (!t->in) return -1;
+    memcpy(t->in, Z_STRVAL_P(z), t->in_len);
+    return 0;
+}
+
+int px_native_is_native_type(const char *type) {
+    return strncmp(type, PX_NATIVE_PREFIX, sizeof(PX_NATIVE_PREFIX) - 1) == 0;
+}
+
+static int native_prepare(px_native_task *t, const char *name, HashTable *args, const char **err) {
+    if (strcmp(name, "deflate") == 0) {
+        t->kind = PX_NATIVE_DEFLATE;
+        t->level = arg_long(args, "level", 6);
+        if (t->level < -1 || t->level > 9) {
+            *err = "level must be between -1 and 9";
+            return -1;
+        }
+        zval *fmt = arg_find(args, "format");
+        const char *f = fmt && Z_TYPE_P(fmt) == IS_STRING ? Z_STRVAL_P(fmt) : "raw";
+        if (strcmp(f, "raw") == 0) t->window_bits = -15;
+        else if (strcmp(f, "zlib") == 0) t->window_bits = 15;
+        else if (strcmp(f, "gzip") == 0) t->window_bits = 31;
+        else {
+            *err = "format must be raw, zlib or gzip";
+            return -1;
+        }
+        if (arg_bytes(args, "data", t) != 0) {
+            *err = "args.data must be a string";
+            return -1;
+        }
+    } else if (strcmp(name, "crc32") == 0) {
+        t->kind = PX_NATIVE_CRC32;
+        if (arg_bytes(args, "data", t) != 0) {
+            *err = "args.data must be a string";
+            return -1;
+        }
+    } else if (strcmp(name, "noise2d") == 0) {
+        t->kind = PX_NATIVE_NOISE2D;
+        t->x = arg_double(args, "x", 0.0);
+        t->z = arg_double(args, "z", 0.0);
+        t->width = arg_long(args, "width", 16);
+        t->height = arg_long(args, "height", 16);
+        t->scale = arg_double(args, "scale", 1.0 / 64.0);
+        t->seed = arg_long(args, "seed", 0);
+        t->octaves = arg_long(args, "octaves", 1);
+        t->persistence = arg_double(args, "persistence", 0.5);
+        if (t->width <= 0 || t->height <= 0 || t->width > PX_NATIVE_MAX_NOISE || t->height > PX_NATIVE_MAX_NOISE ||
+            t->width * t->height > PX_NATIVE_MAX_NOISE) {
+            *err = "invalid width/height";
+            return -1;
+        }
+        if (t->octaves < 1 || t->octaves > 16) {
+            *err = "octaves must be between 1 and 16";
+            return -1;
+        }
+    } else if (strcmp(name, "f32_affine") == 0) {
+        t->kind = PX_NATIVE_F32_AFFINE;
+        t->mul = arg_double(args, "mul", 1.0);
+        t->add = arg_double(args, "add", 0.0);
+        zval *lo = arg_find(args, "min"), *hi = arg_find(args, "max");
+        t->clamp = lo || hi;
+        t->lo = lo ? zval_get_double(lo) : -INFINITY;
+        t->hi = hi ? zval_get_double(hi) : INFINITY;
+        if (arg_bytes(args, "data", t) != 0) {
+            *err = "args.data must be a string";
+            return -1;
+        }
+    } else {
+        *err = "unknown native type";
+        return -1;
+    }
+    return 0;
+}
+
+zend_result px_native_submit(unsigned long tid, const char *type, zval *desc, zval *callback) {
+    const char *err = NULL;
+    px_native_task *t = (px_native_task *) calloc(1, sizeof(px_native_task));
+    if (!t) return FAILURE;
+    t->task_id = tid;
+
+    zval *zargs = zend_hash_str_find(Z_ARRVAL_P(desc), "args", sizeof("args") - 1);
+    HashTable *args = zargs && Z_TYPE_P(zargs) == IS_ARRAY ? Z_ARRVAL_P(zargs) : NULL;
+    if (native_prepare(t, type + sizeof(PX_NATIVE_PREFIX) - 1, args, &err) != 0) {
+        php_error_docref(NULL, E_WARNING, "parallelx: %s: %s", type, err);
+        free(t->in);
+        free(t);
+        return FAILURE;
+    }
+    if (native_start_pool() != 0) {
+        php_error_docref(NULL, E_WARNING, "parallelx: failed to start native thread pool");
+        free(t->in);
+        free(t);
+        return FAILURE;
+    }
+
+    t->callback = (zval *) emalloc(sizeof(zval));
+    ZVAL_COPY(t->callback, callback);
+    t->submit_ns = px_now_ns();
+    px_trace_record(PX_TRACE_SUBMIT, tid, -1, t->submit_ns, 0);
+
+    pthread_mutex_lock(&native_lock);
+    if (job_tail) job_tail->next = t;
+    else job_head = t;
+    job_tail = t;
+    pthread_cond_signal(&native_cond);
+    pthread_mutex_unlock(&native_lock);
+    return SUCCESS;
+}
+
+static void native_free_task(px_native_task *t) {
+    if (t->callback) {
+        zval_ptr_dtor(t->callback);
+        efree(t->callback);
+    }
+    free(t->in);
+    free(t->out);
+    free(t);
+}
+
+/* 完了したnativeタスクのcallbackを呼ぶ(parallelx_pollから) */
+void px_native_drain(void) {
+    if (native_thread_count == 0) return;
+
+    pthread_mutex_lock(&native_lock);
+    px_native_task *t = done_head;
+    done_head = done_tail = NULL;
+    pthread_mutex_unlock(&native_lock);
+
+    while (t) {
+        px_native_task *nx = t->next;
+        uint64_t recv_ns = px_now_ns();
+        px_hist_record(&px_stats.execution, (recv_ns - t->submit_ns) / 1000);
+
+        zval result;
+        array_init(&result);
+        add_assoc_long(&result, "task_id", (zend_long) t->task_id);
+        add_assoc_bool(&result, "success", t->success);
+        if (!t->success) add_assoc_string(&result, "data", (char *) (t->error ? t->error : "error"));
+        else if (t->out_is_long) add_assoc_long(&result, "data", t->out_long);
+        else add_assoc_stringl(&result, "data", t->out ? t->out : "", t->out_len);
+
+        uint64_t cb_ns = px_now_ns();
+        px_invoke_callback(t->callback, &result);
+        uint64_t cb_end_ns = px_now_ns();
+        px_hist_record(&px_stats.callback, (cb_end_ns - cb_ns) / 1000);
+        px_hist_record(&px_stats.end_to_end, (cb_end_ns - t->submit_ns) / 1000);
+        px_trace_record(PX_TRACE_CALLBACK, t->task_id, -1, cb_ns, cb_end_ns - cb_ns);
+        /* workerやforkと同じく、kernelが返したsuccess:falseも完了として数える */
+        px_stats.tasks_completed++;
+
+        zval_ptr_dtor(&result);
+        native_free_task(t);
+        t = nx;
+    }
+}
+
+void px_native_shutdown(void) {
+    if (native_thread_count == 0) return;
+    pthread_mutex_lock(&native_lock);
+    native_stopping = 1;
+    pthread_cond_broadcast(&native_cond);
+    pthread_mutex_unlock(&native_lock);
+    for (int i = 0; i < native_thread_count; ++i) pthread_join(native_threads[i], NULL);
+    native_thread_count = 0;
+
+    px_native_task *lists[2] = {job_head, done_head};
+    for (int i = 0; i < 2; ++i) {
+        px_native_task *t = lists[i];
+        while (t) {
+            px_native_task *nx = t->next;
+            native_free_task(t);
+            t = nx;
+        }
+    }
+    job_head = job_tail = NULL;
+    done_head = done_tail = NULL;
+}
@@ -0,0 +1,99 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "px_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* ownerの登録と統計。キューの出し入れとラウンドロビンは px_queue.c */
+
+px_owner *owner_head = NULL;
+
+static px_owner *owner_find(const char *name) {
+    for (px_owner *o = owner_head; o; o = o->next) {
+        if (strcmp(o->name, name) == 0) return o;
+    }
+    return NULL;
+}
+
+int px_owner_has_slot(const px_owner *o) {
+    return o->max_inflight == 0 || o->inflight < o->max_inflight;
+}
+
+/* 無ければweight 1、上限なしで作る。NULLは未指定(default owner) */
+px_owner *px_owner_get(const char *name) {
+    if (!name) name = PX_OWNER_DEFAULT;
+    px_owner *o = owner_find(name);
+    if (o) return o;
+    o = (px_owner *) calloc(1, sizeof(px_owner));
+    if (!o) return NULL;
+    o->name = px_strdup(name);
+    if (!o->name) {
+        free(o);
+        return NULL;
+    }
+    o->weight = 1;
+    /* 末尾に足してラウンドロビンの順序を登録順にする */
+    px_owner **pp = &owner_head;
+    while (*pp) pp = &(*pp)->next;
+    *pp = o;
+    return o;
+}
+
+/* submitの options 配列から 'owner' を取り出す。0: OK, -1: 不正な値 */
+int px_owner_from_options(zval *options, px_owner **out) {
+    const char *name = NULL;
+    if (options && Z_TYPE_P(options) == IS_ARRAY) {
+        zval *z = zend_hash_str_find(Z_ARRVAL_P(options), "owner", sizeof("owner") - 1);
+        if (z && Z_TYPE_P(z) != IS_NULL) {
+            if (Z_TYPE_P(z) != IS_STRING || Z_STRLEN_P(z) == 0) return -1;
+            name = Z_STRVAL_P(z);
+        }
+    }
+    *out = px_owner_get(name);
+    return *out ? 0 : -1;
+}
+
+void px_owner_stats_reset(void) {
+    for (px_owner *o = owner_head; o; o = o->next) {
+        o->submitted = 0;
+        o->completed = 0;
+        o->failed = 0;
+        memset(&o->queue_wait, 0, sizeof(o->queue_wait));
+    }
+}
+
+void px_owner_stats_to_array(zval *out) {
+    uint64_t uptime_ns = px_stats.started_ns ? px_now_ns() - px_stats.started_ns : 0;
+    array_init(out);
+    for (px_owner *o = owner_head; o; o = o->next) {
+        zval oz, hz;
+        array_init(&oz);
+        add_assoc_long(&oz, "weight", o->weight);
+        add_assoc_long(&oz, "max_inflight", o->max_inflight);
+        add_assoc_long(&oz, "depth", (zend_long) o->depth);
+        add_assoc_long(&oz, "inflight", o->inflight);
+        add_assoc_long(&oz, "submitted", (zend_long) o->submitted);
+        add_assoc_long(&oz, "completed", (zend_long) o->completed);
+        add_assoc_long(&oz, "failed", (zend_long) o->failed);
+        add_assoc_double(&oz, "throughput_per_s",
+                         uptime_ns ? (double) o->completed / ((double) uptime_ns / 1e9) : 0.0);
+        px_hist_to_array(&o->queue_wait, &hz);
+        add_assoc_zval(&oz, "queue_wait_us", &hz);
+        add_assoc_zval(out, o->name, &oz);
+    }
+}
+
+/* 各ownerのキューは px_queue_free_all で空にしてから呼ぶ */
+void px_owner_free_all(void) {
+    px_owner *o = owner_head;
+    while (o) {
+        px_owner *nx = o->next;
+        free(o->name);
+        free(o);
+        o = nx;
+    }
+    owner_head = NULL;
+}
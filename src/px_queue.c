@@ -6,22 +6,104 @@
 
 #include <stdlib.h>
 
+/* ラウンドロビンの現在位置。NULLならowner_headから */
+static px_owner *drr_cursor = NULL;
+
 static void pending_push(pending_node *n) {
+    px_owner *o = n->owner;
     n->next = NULL;
-    if (!pending_tail) pending_head = pending_tail = n;
+    if (++px_stats.queue_depth > px_stats.queue_peak) px_stats.queue_peak = px_stats.queue_depth;
+    o->depth++;
+    if (!o->tail) o->head = o->tail = n;
     else {
-        pending_tail->next = n;
-        pending_tail = n;
+        o->tail->next = n;
+        o->tail = n;
     }
 }
 
+static int owner_eligible(const px_owner *o) {
+    return o->head && px_owner_has_slot(o);
+}
+
+static void drr_advance(px_owner *o) {
+    drr_cursor = o->next ? o->next : owner_head;
+}
+
+/*
+ * weight付きのdeficit round robin(タスク1つのコストを1とする)。
+ * ownerの順番が来たら weight 個まで続けて取り出し、次のownerへ進む。
+ * max_inflightに達しているownerは飛ばす
+ */
 static pending_node *pending_pop(void) {
-    pending_node *n = pending_head;
-    if (!n) return NULL;
-    pending_head = n->next;
-    if (!pending_head) pending_tail = NULL;
-    n->next = NULL;
-    return n;
+    if (!px_stats.queue_depth || !owner_head) return NULL;
+    int owners = 0;
+    for (px_owner *o = owner_head; o; o = o->next) owners++;
+
+    for (int visited = 0; visited <= owners; ++visited) {
+        px_owner *o = drr_cursor ? drr_cursor : owner_head;
+        if (!owner_eligible(o)) {
+            o->deficit = 0;
+            drr_advance(o);
+            continue;
+        }
+        if (o->deficit <= 0) o->deficit = o->weight;
+        o->deficit--;
+
+        pending_node *n = o->head;
+        o->head = n->next;
+        if (!o->head) o->tail = NULL;
+        n->next = NULL;
+        o->depth--;
+        px_stats.queue_depth--;
+
+        if (o->deficit <= 0 || !o->head) {
+            o->deficit = 0;
+            drr_advance(o);
+        } else {
+            drr_cursor = o;
+        }
+        return n;
+    }
+    return NULL;
+}
+
+/* 送れなかったタスクをownerのキューの先頭に戻す */
+static void pending_unpop(pending_node *n) {
+    px_owner *o = n->owner;
+    n->next = o->head;
+    o->head = n;
+    if (!o->tail) o->tail = n;
+    o->depth++;
+    px_stats.queue_depth++;
+}
+
+/* 送信に成功したらworkerにownerを結びつける。0: 成功。hedgeの複製もここを通す */
+int px_dispatch_node(px_worker *w, pending_node *n) {
+    if (px_send_to_worker(w, n->payload, n->payload_len, n->task_id) != 0) return -1;
+    w->owner = n->owner;
+    w->exec_hist = n->exec_hist;
+    w->usage = n->usage;
+    if (n->owner) n->owner->inflight++;
+    px_stats_on_dispatch(w, n->submit_ns);
+    return 0;
+}
+
+/* hedge対象ならpayloadはhedge側へ移る */
+static int dispatch(px_worker *w, pending_node *n) {
+    if (px_dispatch_node(w, n) != 0) return -1;
+    px_hedge_track(n);
+    return 0;
+}
+
+/* 送り終えたnodeを片付ける。切り替え待ちの新しい世代に送ったものは、落ちたときに
+ * 旧世代でやり直せるようworkerに控えておく */
+static void dispatched(px_worker *w, pending_node *n) {
+    if (n->payload && px_reload_unconfirmed(w)) {
+        w->retry = n;
+        return;
+    }
+    if (n->payload) efree(n->payload);
+    free(n);
 }
 
 static zend_result running_add(unsigned long id, zval *cb) {
@@ -52,6 +134,11 @@ zval *px_running_pop(unsigned long id) {
 
 void px_invoke_callback(zval *cb, zval *assoc) {
     if (!cb || Z_TYPE_P(cb) == IS_UNDEF) return;
+    /* callbackなしのタスクは溜めておいてまとめて渡す */
+    if (Z_TYPE_P(cb) == IS_NULL || Z_TYPE_P(cb) == IS_PTR) {
+        px_batch_collect(cb, assoc);
+        return;
+    }
     zval retval;
     ZVAL_UNDEF(&retval);
     zval param;
@@ -64,8 +151,14 @@ void px_invoke_callback(zval *cb, zval *assoc) {
 }
 
 void px_fail_task(unsigned long tid, const char *message) {
+    /* hedgeしたもう一方がまだ走っていれば、そちらの結果を待つ */
+    if (px_hedge_on_fail(tid)) return;
     zval *cb = px_running_pop(tid);
-    if (!cb) return;
+    if (!cb) {
+        px_memo_fail(tid, message);
+        return;
+    }
+    px_stats.tasks_failed++;
 
     zval result;
     array_init(&result);
@@ -78,16 +171,44 @@ void px_fail_task(unsigned long tid, const char *message) {
     zval_ptr_dtor(cb);
     efree(cb);
     zval_ptr_dtor(&result);
+
+    /* single-flightで待ち合わせていたタスクも同じ理由で失敗させる */
+    px_memo_fail(tid, message);
+}
+
+/* wで実行中のタスクを手放す。控えのあるタスク(切り替え待ちの新しい世代)はキューの先頭へ戻し、
+ * それ以外はmessageで失敗させる */
+void px_worker_abandon(px_worker *w, const char *message) {
+    if (!w->busy || !w->current_task_id) return;
+    unsigned long tid = w->current_task_id;
+    px_owner *owner = w->owner;
+    pending_node *n = w->retry;
+    w->retry = NULL;
+    px_worker_release(w);
+    if (n) {
+        pending_unpop(n);
+        return;
+    }
+    if (owner) owner->failed++;
+    px_fail_task(tid, message);
 }
 
-zend_result px_enqueue_payload(unsigned long tid, char *payload, size_t payload_len, zval *callback) {
+zend_result px_enqueue_payload(unsigned long tid, char *payload, size_t payload_len, zval *callback, const px_task_opts *opts) {
+    px_owner *owner = opts->owner;
     pending_node *node = (pending_node *) malloc(sizeof(pending_node));
     if (!node) return FAILURE;
 
     node->task_id = tid;
     node->payload = payload;
     node->payload_len = payload_len;
+    node->submit_ns = px_now_ns();
+    node->owner = owner;
+    node->exec_hist = opts->exec_hist;
+    node->usage = opts->usage;
+    node->hedge_us = opts->hedge_us;
     node->next = NULL;
+    owner->submitted++;
+    px_trace_record(PX_TRACE_SUBMIT, tid, -1, node->submit_ns, 0);
 
     zval *cb_copy = (zval *) emalloc(sizeof(zval));
     if (!cb_copy) {
@@ -114,55 +235,57 @@ zend_result px_enqueue_payload(unsigned long tid, char *payload, size_t payload_
         return FAILURE;
     }
 
-    px_worker *w = px_find_idle_worker();
-    if (w) {
-        if (px_send_to_worker(w, node->payload, node->payload_len, node->task_id) != 0) {
-            pending_push(node);
-        } else {
-            efree(node->payload);
-            free(node);
-            return SUCCESS;
-        }
-    } else {
-        pending_push(node);
+    /* 待っているタスクがあれば順番を守ってキューに積む */
+    px_worker *w = owner->depth == 0 && px_owner_has_slot(owner) ? px_find_idle_worker() : NULL;
+    if (w && dispatch(w, node) == 0) {
+        dispatched(w, node);
+        return SUCCESS;
     }
+    pending_push(node);
     return SUCCESS;
 }
 
+/* 1: 送った, 0: 送れるタスクが無い, -1: 送信失敗 */
 int px_assign_pending(px_worker *w) {
+    if (w->draining || w->retired) return 0;
     pending_node *p = pending_pop();
     if (!p) return 0;
-    int rc = px_send_to_worker(w, p->payload, p->payload_len, p->task_id);
-    if (rc != 0) {
-        pending_push(p);
+    if (dispatch(w, p) != 0) {
+        pending_unpop(p);
         return -1;
     }
-    efree(p->payload);
-    free(p);
-    return 0;
+    dispatched(w, p);
+    return 1;
 }
 
 void px_dispatch_pending_to_idle(void) {
-    while (pending_head) {
+    while (px_stats.queue_depth) {
         px_worker *w = px_find_idle_worker();
         if (!w) break;
-        if (px_assign_pending(w) != 0) break;
+        if (px_assign_pending(w) <= 0) break;
     }
 }
 
 void px_queue_free_all(void) {
-    pending_node *pn = pending_head;
-    while (pn) {
-        pending_node *nx = pn->next;
-        if (pn->payload) efree(pn->payload);
-        if (pn->callback) {
-            zval_ptr_dtor(pn->callback);
-            efree(pn->callback);
+    for (px_owner *o = owner_head; o; o = o->next) {
+        pending_node *pn = o->head;
+        while (pn) {
+            pending_node *nx = pn->next;
+            if (pn->payload) efree(pn->payload);
+            if (pn->callback) {
+                zval_ptr_dtor(pn->callback);
+                efree(pn->callback);
+            }
+            free(pn);
+            pn = nx;
         }
-        free(pn);
-        pn = nx;
+        o->head = o->tail = NULL;
+        o->depth = 0;
+        o->inflight = 0;
+        o->deficit = 0;
     }
-    pending_head = pending_tail = NULL;
+    drr_cursor = NULL;
+    px_stats.queue_depth = 0;
 
     running_node *rn = running_head;
     while (rn) {
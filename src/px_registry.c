@@ -37,15 +37,20 @@ closure_entry *px_registry_find(const char *token) {
     return NULL;
 }
 
-char *px_registry_insert(const char *source, const char *bound_b64) {
-    char *token = generate_token();
-    if (!token) return NULL;
+/* tokenの所有権を受け取ってentryを作る */
+static char *registry_add(char *token, const char *source, const char *bound_b64) {
     closure_entry *e = (closure_entry *) malloc(sizeof(closure_entry));
     if (!e) {
         free(token);
         return NULL;
     }
     e->token = token;
+    e->memo = NULL;
+    e->exec_hist = NULL;
+    memset(&e->usage, 0, sizeof(e->usage));
+    ZVAL_UNDEF(&e->batch_cb);
+    ZVAL_UNDEF(&e->batch);
+    e->batch_next = NULL;
     e->source = px_strdup(source ? source : "");
     e->bound_b64 = px_strdup(bound_b64 ? bound_b64 : "");
     if (!e->source || !e->bound_b64) {
@@ -60,6 +65,30 @@ char *px_registry_insert(const char *source, const char *bound_b64) {
     return token;
 }
 
+char *px_registry_insert(const char *source, const char *bound_b64) {
+    char *token = generate_token();
+    if (!token) return NULL;
+    return registry_add(token, source, bound_b64);
+}
+
+/* 内容から作ったtoken。同じ内容で登録済みならそのentryのtokenを返す。
+ * ハッシュが衝突して内容が違うときは "_<n>" を付けて別のtokenにする */
+char *px_registry_insert_named(const char *token, const char *source, const char *bound_b64) {
+    char salted[64];
+    snprintf(salted, sizeof(salted), "%s", token);
+    for (int n = 1; n <= PX_REGISTRY_SALT_MAX; ++n) {
+        closure_entry *e = px_registry_find(salted);
+        if (!e) {
+            char *copy = px_strdup(salted);
+            if (!copy) return NULL;
+            return registry_add(copy, source, bound_b64);
+        }
+        if (strcmp(e->source, source) == 0 && strcmp(e->bound_b64, bound_b64) == 0) return e->token;
+        snprintf(salted, sizeof(salted), "%s_%d", token, n);
+    }
+    return NULL;
+}
+
 void px_registry_free_all(void) {
     closure_entry *ce = closure_head;
     while (ce) {
@@ -67,6 +96,10 @@ void px_registry_free_all(void) {
         if (ce->token) free(ce->token);
         if (ce->source) free(ce->source);
         if (ce->bound_b64) free(ce->bound_b64);
+        px_memo_destroy(ce->memo);
+        free(ce->exec_hist);
+        zval_ptr_dtor(&ce->batch_cb);
+        zval_ptr_dtor(&ce->batch);
         free(ce);
         ce = nx;
     }
@@ -0,0 +1,400 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "px_internal.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * worker daemon(worker/parallelx_daemon.php)へのソケット接続。
+ * 1接続 = 1 slot = 1 worker。接続直後にこちらが共有secretを載せたauthフレームを送り、
+ * daemonが照合できたらhelloフレームでslot数を返す。
+ * 以降はローカルのworkerと同じフレームをそのまま流す。dispatcherから見ると
+ * to_child/from_childがソケットなだけの普通のpx_worker
+ */
+
+static px_remote *remote_head = NULL;
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* non-blockingでconnectしてタイムアウトまで待つ */
+static int connect_timeout(int fd, const struct sockaddr *sa, socklen_t len) {
+    if (set_nonblocking(fd) != 0) return -1;
+    if (connect(fd, sa, len) == 0) return 0;
+    if (errno != EINPROGRESS) return -1;
+    struct pollfd p = {.fd = fd, .events = POLLOUT};
+    if (poll(&p, 1, PX_REMOTE_CONNECT_MS) != 1) return -1;
+    int err = 0;
+    socklen_t el = sizeof(err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &el) != 0 || err != 0) return -1;
+    return 0;
+}
+
+/* 接続できたアドレスをrに覚えておく(再接続用) */
+static void remember_addr(px_remote *r, const struct sockaddr *sa, socklen_t len) {
+    if (len > sizeof(r->addr)) return;
+    memcpy(&r->addr, sa, len);
+    r->addr_len = len;
+}
+
+static void set_nodelay(int fd, int family) {
+    if (family != AF_INET && family != AF_INET6) return;
+    int one = 1;
+    (void) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+static int remote_connect(px_remote *r) {
+    const char *address = r->address;
+    if (strncmp(address, "unix://", 7) == 0) {
+        struct sockaddr_un sun;
+        const char *path = address + 7;
+        if (strlen(path) >= sizeof(sun.sun_path)) return -1;
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        strcpy(sun.sun_path, path);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (connect_timeout(fd, (struct sockaddr *) &sun, sizeof(sun)) != 0) {
+            close(fd);
+            return -1;
+        }
+        remember_addr(r, (struct sockaddr *) &sun, sizeof(sun));
+        return fd;
+    }
+
+    if (strncmp(address, "tcp://", 6) != 0) return -1;
+    char host[256];
+    const char *hp = address + 6;
+    const char *colon = strrchr(hp, ':');
+    if (!colon || colon == hp || (size_t) (colon - hp) >= sizeof(host)) return -1;
+    memcpy(host, hp, (size_t) (colon - hp));
+    host[colon - hp] = '\0';
+    /* [::1]:port 形式 */
+    char *h = host;
+    if (h[0] == '[') {
+        h++;
+        char *rb = strchr(h, ']');
+        if (rb) *rb = '\0';
+    }
+
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(h, colon + 1, &hints, &res) != 0) return -1;
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        if (connect_timeout(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            remember_addr(r, ai->ai_addr, ai->ai_addrlen);
+            set_nodelay(fd, ai->ai_family);
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static int write_exact(int fd, const char *buf, size_t len) {
+    size_t put = 0;
+    while (put < len) {
+        struct pollfd p = {.fd = fd, .events = POLLOUT};
+        if (poll(&p, 1, PX_REMOTE_CONNECT_MS) != 1) return -1;
+        ssize_t n = write(fd, buf + put, len - put);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+        if (n <= 0) return -1;
+        put += (size_t) n;
+    }
+    return 0;
+}
+
+/* {"parallelx":"auth","secret":...} を長さ付きフレームにしてrに持たせる */
+static int build_auth(px_remote *r, const char *secret) {
+    zval auth;
+    array_init(&auth);
+    add_assoc_string(&auth, "parallelx", "auth");
+    add_assoc_string(&auth, "secret", (char *) secret);
+    smart_str buf = {0};
+    zend_result rc = php_json_encode(&buf, &auth, 0);
+    zval_ptr_dtor(&auth);
+    smart_str_0(&buf);
+    if (rc != SUCCESS || !buf.s) {
+        smart_str_free(&buf);
+        return -1;
+    }
+    size_t len = ZSTR_LEN(buf.s);
+    r->auth = (char *) malloc(4 + len);
+    if (!r->auth) {
+        smart_str_free(&buf);
+        return -1;
+    }
+    uint32_t be = htonl((uint32_t) len);
+    memcpy(r->auth, &be, 4);
+    memcpy(r->auth + 4, ZSTR_VAL(buf.s), len);
+    r->auth_len = 4 + len;
+    smart_str_free(&buf);
+    return 0;
+}
+
+static int read_exact(int fd, char *buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        struct pollfd p = {.fd = fd, .events = POLLIN};
+        if (poll(&p, 1, PX_REMOTE_CONNECT_MS) != 1) return -1;
+        ssize_t n = read(fd, buf + got, len - got);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+        if (n <= 0) return -1;
+        got += (size_t) n;
+    }
+    return 0;
+}
+
+/* フレーム先頭4バイトからhelloの長さを取り出す。0: 不正 */
+static uint32_t hello_len(const char *hdr) {
+    uint32_t be;
+    memcpy(&be, hdr, 4);
+    uint32_t len = ntohl(be);
+    if (len == 0 || len > PX_REMOTE_HELLO_MAX) return 0;
+    return len;
+}
+
+/* helloの本体からslot数を返す。-1: 不正 */
+static int parse_hello(const char *buf, size_t len) {
+    int slots = -1;
+    zval hello;
+    if (px_decode_worker_json(buf, len, &hello) != SUCCESS) return -1;
+    if (Z_TYPE(hello) == IS_ARRAY) {
+        zval *magic = zend_hash_str_find(Z_ARRVAL(hello), "parallelx", sizeof("parallelx") - 1);
+        zval *zs = zend_hash_str_find(Z_ARRVAL(hello), "slots", sizeof("slots") - 1);
+        if (magic && Z_TYPE_P(magic) == IS_STRING && strcmp(Z_STRVAL_P(magic), "hello") == 0 && zs &&
+            Z_TYPE_P(zs) == IS_LONG && Z_LVAL_P(zs) >= 0) {
+            slots = (int) Z_LVAL_P(zs);
+        }
+    }
+    zval_ptr_dtor(&hello);
+    return slots;
+}
+
+/* helloフレームを読んでslot数を返す。-1: 不正 */
+static int read_hello(int fd) {
+    char hdr[4];
+    if (read_exact(fd, hdr, 4) != 0) return -1;
+    uint32_t len = hello_len(hdr);
+    if (len == 0) return -1;
+    char buf[PX_REMOTE_HELLO_MAX + 1];
+    if (read_exact(fd, buf, len) != 0) return -1;
+    buf[len] = '\0';
+    return parse_hello(buf, len);
+}
+
+/* 接続してhelloを受け取り、wをそのソケットのslotにする。戻り値はdaemonのslot数、-1: 失敗 */
+static int remote_open(px_worker *w, px_remote *r) {
+    int fd = remote_connect(r);
+    if (fd < 0) return -1;
+    if (write_exact(fd, r->auth, r->auth_len) != 0) {
+        close(fd);
+        return -1;
+    }
+    int slots = read_hello(fd);
+    if (slots <= 0) {
+        close(fd);
+        return -1;
+    }
+    int wfd = dup(fd);
+    if (wfd < 0) {
+        close(fd);
+        return -1;
+    }
+    w->pid = -1;
+    w->generation = px_generation;
+    w->from_child = fd;
+    w->to_child = wfd;
+    w->remote = r;
+    w->dead = 0;
+    w->retry_ns = 0;
+    return slots;
+}
+
+int px_remote_add(const char *address, int max_slots, const char *secret, char *err, size_t err_len) {
+    if (strncmp(address, "unix://", 7) != 0 && strncmp(address, "tcp://", 6) != 0) {
+        snprintf(err, err_len, "address must start with unix:// or tcp://");
+        return -1;
+    }
+    if (px_worker_count >= PARALLELX_MAX_WORKERS) {
+        snprintf(err, err_len, "worker limit (%d) reached", PARALLELX_MAX_WORKERS);
+        return -1;
+    }
+    px_remote *r = (px_remote *) calloc(1, sizeof(px_remote));
+    if (!r || !(r->address = px_strdup(address)) || build_auth(r, secret) != 0) {
+        if (r) free(r->address);
+        free(r);
+        snprintf(err, err_len, "out of memory");
+        return -1;
+    }
+
+    px_worker *first = &workers[px_worker_count];
+    memset(first, 0, sizeof(*first));
+    int slots = remote_open(first, r);
+    if (slots < 0) {
+        memset(first, 0, sizeof(*first));
+        free(r->address);
+        free(r->auth);
+        free(r);
+        snprintf(err, err_len, "connect, auth or hello failed: %s", address);
+        return -1;
+    }
+    if (max_slots > 0 && slots > max_slots) slots = max_slots;
+    if (slots > PARALLELX_MAX_WORKERS - px_worker_count) slots = PARALLELX_MAX_WORKERS - px_worker_count;
+    px_worker_count++;
+
+    int added = 1;
+    while (added < slots) {
+        px_worker *w = &workers[px_worker_count];
+        memset(w, 0, sizeof(*w));
+        if (remote_open(w, r) < 0) {
+            memset(w, 0, sizeof(*w));
+            break;
+        }
+        px_worker_count++;
+        added++;
+    }
+    r->slots = added;
+    r->next = remote_head;
+    remote_head = r;
+    return added;
+}
+
+/* 再接続に失敗したslotはdeadのまま PX_REMOTE_RETRY_MS 後に再試行 */
+static int reconnect_failed(px_worker *w) {
+    if (w->from_child >= 0) close(w->from_child);
+    if (w->recv_buf) free(w->recv_buf);
+    w->from_child = -1;
+    w->recv_buf = NULL;
+    w->recv_used = 0;
+    w->recv_cap = 0;
+    w->connecting = 0;
+    w->dead = 1;
+    w->retry_ns = px_now_ns() + (uint64_t) PX_REMOTE_RETRY_MS * 1000000ULL;
+    return -1;
+}
+
+/*
+ * 切れたslotを同じdaemonへつなぎ直す。pollから呼ばれるのでここでは待たない:
+ * non-blockingのconnectを始めるだけで、完了とhelloの受信は px_remote_poll_connect() が
+ * tickごとに進める。つながるまではdeadのままなのでタスクは送られない
+ */
+int px_remote_reconnect(px_worker *w) {
+    px_remote *r = w->remote;
+    int generation = w->generation;
+    if (w->to_child >= 0) close(w->to_child);
+    if (w->from_child >= 0) close(w->from_child);
+    if (w->recv_buf) free(w->recv_buf);
+    if (w->send_buf) free(w->send_buf);
+    memset(w, 0, sizeof(*w));
+    w->pid = -1;
+    w->to_child = -1;
+    w->from_child = -1;
+    w->remote = r;
+    w->generation = generation;
+    w->dead = 1;
+    if (r->addr_len == 0) return reconnect_failed(w);
+
+    int fd = socket(r->addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0) return reconnect_failed(w);
+    w->from_child = fd;
+    if (set_nonblocking(fd) != 0) return reconnect_failed(w);
+    if (connect(fd, (struct sockaddr *) &r->addr, r->addr_len) != 0 && errno != EINPROGRESS) {
+        return reconnect_failed(w);
+    }
+    w->connecting = 1;
+    w->retry_ns = px_now_ns() + (uint64_t) PX_REMOTE_CONNECT_MS * 1000000ULL;
+    return 0;
+}
+
+/* 再接続中のslotを進める。1: helloまで届いて使える 0: まだ -1: 失敗(再試行待ちへ) */
+int px_remote_poll_connect(px_worker *w) {
+    int fd = w->from_child;
+    if (px_now_ns() > w->retry_ns) return reconnect_failed(w);
+
+    if (w->connecting == 1) {
+        struct pollfd p = {.fd = fd, .events = POLLOUT};
+        int rc = poll(&p, 1, 0);
+        if (rc == 0) return 0;
+        if (rc < 0) return errno == EINTR ? 0 : reconnect_failed(w);
+        int err = 0;
+        socklen_t el = sizeof(err);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &el) != 0 || err != 0) return reconnect_failed(w);
+        set_nodelay(fd, w->remote->addr.ss_family);
+        /* authフレームは小さいので新しいソケットなら一度で書ける。書けなければ次の再試行で */
+        ssize_t n = write(fd, w->remote->auth, w->remote->auth_len);
+        if (n < 0 || (size_t) n != w->remote->auth_len) return reconnect_failed(w);
+        w->recv_buf = (char *) malloc(4 + PX_REMOTE_HELLO_MAX + 1);
+        if (!w->recv_buf) return reconnect_failed(w);
+        w->recv_cap = 4 + PX_REMOTE_HELLO_MAX + 1;
+        w->recv_used = 0;
+        w->connecting = 2;
+    }
+
+    /* ヘッダを読み終えるまでは4バイト、そのあとは本体の終わりまで */
+    while (1) {
+        size_t want = 4;
+        if (w->recv_used >= 4) {
+            uint32_t len = hello_len(w->recv_buf);
+            if (len == 0) return reconnect_failed(w);
+            want = 4 + (size_t) len;
+        }
+        if (w->recv_used >= want) break;
+        ssize_t n = read(fd, w->recv_buf + w->recv_used, want - w->recv_used);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (n <= 0) return reconnect_failed(w);
+        w->recv_used += (size_t) n;
+    }
+
+    size_t len = w->recv_used - 4;
+    w->recv_buf[w->recv_used] = '\0';
+    if (parse_hello(w->recv_buf + 4, len) <= 0) return reconnect_failed(w);
+    int wfd = dup(fd);
+    if (wfd < 0) return reconnect_failed(w);
+    free(w->recv_buf);
+    w->recv_buf = NULL;
+    w->recv_used = 0;
+    w->recv_cap = 0;
+    w->to_child = wfd;
+    w->connecting = 0;
+    w->dead = 0;
+    w->retry_ns = 0;
+    return 1;
+}
+
+void px_remote_free_all(void) {
+    px_remote *r = remote_head;
+    while (r) {
+        px_remote *nx = r->next;
+        free(r->address);
+        free(r->auth);
+        free(r);
+        r = nx;
+    }
+    remote_head = NULL;
+}
@@ -0,0 +1,160 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "px_internal.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* 型付き共有バッファ。/dev/shm上のファイルをmmapし、workerはパス経由で同じページへ直接書き込む */
+
+static px_shm_buffer *shm_head = NULL;
+static zend_long shm_next_id = 1;
+
+static const struct {
+    const char *name;
+    px_shm_type type;
+    size_t elem_size;
+} shm_types[] = {
+    {"int8", PX_SHM_INT8, 1},
+    {"uint8", PX_SHM_UINT8, 1},
+    {"int32", PX_SHM_INT32, 4},
+    {"float", PX_SHM_FLOAT, 4},
+};
+
+int px_shm_type_from_name(const char *name, px_shm_type *type, size_t *elem_size) {
+    for (size_t i = 0; i < sizeof(shm_types) / sizeof(shm_types[0]); ++i) {
+        if (strcmp(shm_types[i].name, name) == 0) {
+            *type = shm_types[i].type;
+            *elem_size = shm_types[i].elem_size;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *px_shm_type_name(px_shm_type type) {
+    for (size_t i = 0; i < sizeof(shm_types) / sizeof(shm_types[0]); ++i) {
+        if (shm_types[i].type == type) return shm_types[i].name;
+    }
+    return "unknown";
+}
+
+px_shm_buffer *px_shm_alloc(px_shm_type type, size_t elem_size, size_t length) {
+    if (length == 0 || length > PARALLELX_MAX_SHM / elem_size) return NULL;
+
+    px_shm_buffer *b = (px_shm_buffer *) calloc(1, sizeof(px_shm_buffer));
+    if (!b) return NULL;
+
+    char template[] = SHM_TEMPLATE;
+    int fd = mkstemp(template);
+    if (fd < 0) {
+        free(b);
+        return NULL;
+    }
+    size_t size = elem_size * length;
+    if (ftruncate(fd, (off_t) size) != 0) {
+        close(fd);
+        unlink(template);
+        free(b);
+        return NULL;
+    }
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        unlink(template);
+        free(b);
+        return NULL;
+    }
+
+    b->id = shm_next_id++;
+    strncpy(b->path, template, PATH_MAX - 1);
+    b->path[PATH_MAX - 1] = '\0';
+    b->type = type;
+    b->elem_size = elem_size;
+    b->length = length;
+    b->size = size;
+    b->addr = addr;
+    b->next = shm_head;
+    shm_head = b;
+    return b;
+}
+
+px_shm_buffer *px_shm_find(zend_long id) {
+    px_shm_buffer *b = shm_head;
+    while (b) {
+        if (b->id == id) return b;
+        b = b->next;
+    }
+    return NULL;
+}
+
+static void shm_release(px_shm_buffer *b) {
+    if (b->addr) munmap(b->addr, b->size);
+    unlink(b->path);
+    free(b);
+}
+
+int px_shm_free(zend_long id) {
+    px_shm_buffer *prev = NULL, *cur = shm_head;
+    while (cur) {
+        if (cur->id == id) {
+            if (prev) prev->next = cur->next;
+            else shm_head = cur->next;
+            shm_release(cur);
+            return 0;
+        }
+        prev = cur;
+        cur = cur->next;
+    }
+    return -1;
+}
+
+void px_shm_to_array(px_shm_buffer *b, zval *out) {
+    array_init_size(out, (uint32_t) b->length);
+    switch (b->type) {
+        case PX_SHM_INT8: {
+            const int8_t *p = (const int8_t *) b->addr;
+            for (size_t i = 0; i < b->length; ++i) add_next_index_long(out, p[i]);
+            break;
+        }
+        case PX_SHM_UINT8: {
+            const uint8_t *p = (const uint8_t *) b->addr;
+            for (size_t i = 0; i < b->length; ++i) add_next_index_long(out, p[i]);
+            break;
+        }
+        case PX_SHM_INT32: {
+            const int32_t *p = (const int32_t *) b->addr;
+            for (size_t i = 0; i < b->length; ++i) add_next_index_long(out, p[i]);
+            break;
+        }
+        case PX_SHM_FLOAT: {
+            const float *p = (const float *) b->addr;
+            for (size_t i = 0; i < b->length; ++i) add_next_index_double(out, (double) p[i]);
+            break;
+        }
+    }
+}
+
+void px_shm_handle(px_shm_buffer *b, zval *out) {
+    array_init(out);
+    add_assoc_long(out, "id", b->id);
+    add_assoc_string(out, "path", b->path);
+    add_assoc_string(out, "type", (char *) px_shm_type_name(b->type));
+    add_assoc_long(out, "length", (zend_long) b->length);
+    add_assoc_long(out, "elem_size", (zend_long) b->elem_size);
+}
+
+void px_shm_free_all(void) {
+    px_shm_buffer *b = shm_head;
+    while (b) {
+        px_shm_buffer *nx = b->next;
+        shm_release(b);
+        b = nx;
+    }
+    shm_head = NULL;
+}
@@ -0,0 +1,200 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "px_internal.h"
+
+#include <string.h>
+#include <time.h>
+
+/* 常時有効のカウンタとHDR風(log-linear)レイテンシヒストグラム。記録はO(1)でロック不要 */
+
+px_stats_counters px_stats;
+
+uint64_t px_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static int hist_bucket(uint64_t v) {
+    if (v < PX_HIST_SUB) return (int) v;
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - PX_HIST_SUB_BITS;
+    if (shift >= PX_HIST_MAGNITUDES) return PX_HIST_BUCKETS - 1;
+    return (shift + 1) * PX_HIST_SUB + (int) ((v >> shift) - PX_HIST_SUB);
+}
+
+/* bucketに入る値の上限(そのbucketを代表する値として報告する) */
+static uint64_t hist_bucket_upper(int b) {
+    if (b < PX_HIST_SUB) return (uint64_t) b;
+    int shift = b / PX_HIST_SUB - 1;
+    uint64_t sub = (uint64_t) (b % PX_HIST_SUB);
+    return ((PX_HIST_SUB + sub + 1) << shift) - 1;
+}
+
+void px_hist_record(px_hist *h, uint64_t value_us) {
+    h->counts[hist_bucket(value_us)]++;
+    if (h->count == 0 || value_us < h->min) h->min = value_us;
+    if (value_us > h->max) h->max = value_us;
+    h->count++;
+    h->sum += value_us;
+}
+
+uint64_t px_hist_percentile(const px_hist *h, double pct) {
+    if (h->count == 0) return 0;
+    uint64_t want = (uint64_t) ((double) h->count * pct / 100.0 + 0.5);
+    if (want == 0) want = 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < PX_HIST_BUCKETS; ++b) {
+        seen += h->counts[b];
+        if (seen >= want) {
+            uint64_t v = hist_bucket_upper(b);
+            return v > h->max ? h->max : v;
+        }
+    }
+    return h->max;
+}
+
+void px_hist_to_array(const px_hist *h, zval *out) {
+    array_init(out);
+    add_assoc_long(out, "count", (zend_long) h->count);
+    add_assoc_double(out, "mean", h->count ? (double) h->sum / (double) h->count : 0.0);
+    add_assoc_long(out, "min", (zend_long) h->min);
+    add_assoc_long(out, "p50", (zend_long) px_hist_percentile(h, 50.0));
+    add_assoc_long(out, "p90", (zend_long) px_hist_percentile(h, 90.0));
+    add_assoc_long(out, "p99", (zend_long) px_hist_percentile(h, 99.0));
+    add_assoc_long(out, "p999", (zend_long) px_hist_percentile(h, 99.9));
+    add_assoc_long(out, "max", (zend_long) h->max);
+}
+
+void px_stats_reset(void) {
+    /* キュー深さとmemoの使用量は現在値なので残す */
+    uint64_t depth = px_stats.queue_depth;
+    uint64_t memo_bytes = px_stats.memo_bytes;
+    memset(&px_stats, 0, sizeof(px_stats));
+    px_stats.queue_depth = depth;
+    px_stats.memo_bytes = memo_bytes;
+    px_stats.queue_peak = depth;
+    px_stats.started_ns = px_now_ns();
+    px_owner_stats_reset();
+}
+
+void px_stats_on_dispatch(px_worker *w, uint64_t submit_ns) {
+    uint64_t now = px_now_ns();
+    w->submit_ns = submit_ns;
+    w->dispatch_ns = now;
+    px_hist_record(&px_stats.queue_wait, (now - submit_ns) / 1000);
+    if (w->owner) px_hist_record(&w->owner->queue_wait, (now - submit_ns) / 1000);
+    if (px_trace_enabled) {
+        int lane = (int) (w - workers);
+        px_trace_record(PX_TRACE_QUEUE, w->current_task_id, -1, submit_ns, now - submit_ns);
+        px_trace_record(PX_TRACE_DISPATCH, w->current_task_id, lane, now, 0);
+    }
+}
+
+void px_stats_on_complete(px_worker *w, uint64_t recv_ns) {
+    uint64_t now = px_now_ns();
+    if (w->dispatch_ns) {
+        px_hist_record(&px_stats.execution, (recv_ns - w->dispatch_ns) / 1000);
+        if (w->exec_hist) px_hist_record(w->exec_hist, (recv_ns - w->dispatch_ns) / 1000);
+        int idx = (int) (w - workers);
+        if (idx >= 0 && idx < PARALLELX_MAX_WORKERS) {
+            px_stats.workers[idx].tasks++;
+            px_stats.workers[idx].busy_ns += recv_ns - w->dispatch_ns;
+        }
+    }
+    if (w->submit_ns) px_hist_record(&px_stats.end_to_end, (now - w->submit_ns) / 1000);
+    w->submit_ns = 0;
+    w->dispatch_ns = 0;
+}
+
+void px_stats_to_array(zval *out) {
+    uint64_t now = px_now_ns();
+    uint64_t uptime_ns = px_stats.started_ns ? now - px_stats.started_ns : 0;
+    zval z;
+
+    array_init(out);
+    add_assoc_long(out, "uptime_ms", (zend_long) (uptime_ns / 1000000));
+
+    array_init(&z);
+    add_assoc_long(&z, "depth", (zend_long) px_stats.queue_depth);
+    add_assoc_long(&z, "peak_depth", (zend_long) px_stats.queue_peak);
+    int busy = 0;
+    for (int i = 0; i < px_worker_count; ++i) if (workers[i].busy) busy++;
+    add_assoc_long(&z, "running", busy);
+    add_assoc_long(&z, "results_pending", px_batch_pending());
+    add_assoc_zval(out, "queue", &z);
+
+    array_init(&z);
+    add_assoc_long(&z, "submitted", (zend_long) px_stats.tasks_submitted);
+    add_assoc_long(&z, "completed", (zend_long) px_stats.tasks_completed);
+    add_assoc_long(&z, "failed", (zend_long) px_stats.tasks_failed);
+    add_assoc_long(&z, "callback_not_found", (zend_long) px_stats.callback_not_found);
+    add_assoc_long(&z, "decode_errors", (zend_long) px_stats.decode_errors);
+    add_assoc_long(&z, "protocol_errors", (zend_long) px_stats.protocol_errors);
+    add_assoc_zval(out, "tasks", &z);
+
+    array_init(&z);
+    for (int i = 0; i < px_worker_count; ++i) {
+        if (workers[i].retired) continue;
+        zval wz;
+        array_init(&wz);
+        add_assoc_long(&wz, "pid", (zend_long) workers[i].pid);
+        add_assoc_bool(&wz, "busy", workers[i].busy);
+        add_assoc_long(&wz, "tasks", (zend_long) px_stats.workers[i].tasks);
+        add_assoc_long(&wz, "busy_ms", (zend_long) (px_stats.workers[i].busy_ns / 1000000));
+        add_assoc_double(&wz, "utilization",
+                         uptime_ns ? (double) px_stats.workers[i].busy_ns / (double) uptime_ns : 0.0);
+        add_assoc_long(&wz, "restarts", (zend_long) px_stats.workers[i].restarts);
+        add_assoc_long(&wz, "generation", workers[i].generation);
+        add_assoc_bool(&wz, "draining", workers[i].draining);
+        if (workers[i].remote) add_assoc_string(&wz, "remote", workers[i].remote->address);
+        else add_assoc_null(&wz, "remote");
+        add_next_index_zval(&z, &wz);
+    }
+    add_assoc_zval(out, "workers", &z);
+    add_assoc_long(out, "worker_restarts", (zend_long) px_stats.worker_restarts);
+
+    array_init(&z);
+    add_assoc_long(&z, "bytes_sent", (zend_long) px_stats.bytes_sent);
+    add_assoc_long(&z, "bytes_received", (zend_long) px_stats.bytes_received);
+    add_assoc_long(&z, "frames_sent", (zend_long) px_stats.frames_sent);
+    add_assoc_long(&z, "frames_received", (zend_long) px_stats.frames_received);
+    add_assoc_zval(out, "io", &z);
+
+    array_init(&z);
+    add_assoc_long(&z, "encode_count", (zend_long) px_stats.encode_count);
+    add_assoc_long(&z, "encode_us", (zend_long) (px_stats.encode_ns / 1000));
+    add_assoc_long(&z, "decode_count", (zend_long) px_stats.decode_count);
+    add_assoc_long(&z, "decode_us", (zend_long) (px_stats.decode_ns / 1000));
+    add_assoc_zval(out, "codec", &z);
+
+    array_init(&z);
+    add_assoc_long(&z, "hits", (zend_long) px_stats.memo_hits);
+    add_assoc_long(&z, "misses", (zend_long) px_stats.memo_misses);
+    add_assoc_long(&z, "coalesced", (zend_long) px_stats.memo_coalesced);
+    add_assoc_long(&z, "evictions", (zend_long) px_stats.memo_evictions);
+    add_assoc_long(&z, "bytes", (zend_long) px_stats.memo_bytes);
+    add_assoc_zval(out, "memo", &z);
+
+    array_init(&z);
+    add_assoc_long(&z, "launched", (zend_long) px_stats.hedges_launched);
+    add_assoc_long(&z, "won", (zend_long) px_stats.hedges_won);
+    add_assoc_zval(out, "hedge", &z);
+
+    px_owner_stats_to_array(&z);
+    add_assoc_zval(out, "owners", &z);
+
+    array_init(&z);
+    zval hz;
+    px_hist_to_array(&px_stats.queue_wait, &hz);
+    add_assoc_zval(&z, "queue_wait", &hz);
+    px_hist_to_array(&px_stats.execution, &hz);
+    add_assoc_zval(&z, "execution", &hz);
+    px_hist_to_array(&px_stats.end_to_end, &hz);
+    add_assoc_zval(&z, "end_to_end", &hz);
+    px_hist_to_array(&px_stats.callback, &hz);
+    add_assoc_zval(&z, "callback", &hz);
+    add_assoc_zval(out, "latency_us", &z);
+}
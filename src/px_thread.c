@@ -0,0 +1,356 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "px_internal.h"
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+/*
+ * ZTSビルド用のスレッドworker。各スレッドが独自のPHPリクエストコンテキストを持ち、
+ * processワーカーと同じJSON descriptorを実行して同じ形式の結果フレームを返す。
+ * メインスレッドとの受け渡しはスロットごとのatomicな状態遷移で行い、ロックは取らない
+ */
+
+#ifdef ZTS
+
+#include "SAPI.h"
+#include "php_main.h"
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+enum {
+    PX_THREAD_IDLE = 0,
+    PX_THREAD_TASK, /* main -> thread: in が有効 */
+    PX_THREAD_DONE, /* thread -> main: out が有効 */
+    PX_THREAD_STOP,
+};
+
+struct px_thread_slot {
+    pthread_t thread;
+    sem_t wake;
+    _Atomic int state;
+    unsigned long task_id;
+    char *in;
+    size_t in_len;
+    char *out;
+    size_t out_len;
+    uint64_t user_us; /* RUSAGE_THREADで測ったこのタスクのCPU時間 */
+    uint64_t sys_us;
+    /* スレッド自身のEG()。shutdownで止まらないタスクに割り込むため */
+#if PHP_VERSION_ID >= 80200
+    zend_atomic_bool *timed_out;
+    zend_atomic_bool *vm_interrupt;
+#else
+    volatile zend_bool *timed_out;
+    volatile zend_bool *vm_interrupt;
+#endif
+    int detached; /* shutdownで止まらず切り離した */
+};
+
+#define PX_THREAD_RUN_FN "__parallelx_thread_run"
+
+static const char thread_bootstrap[] =
+        "$autoload = getenv('" ENV_AUTLOAD "');\n"
+        "if ($autoload !== false && file_exists($autoload)) { @require_once $autoload; }\n"
+        "function " PX_THREAD_RUN_FN "(string $__data): string {\n"
+        "  $__desc = json_decode($__data, true);\n"
+        "  if (!is_array($__desc)) return json_encode(['task_id'=>0,'success'=>false,'data'=>'invalid descriptor']);\n"
+        "  $__tid = $__desc['task_id'] ?? 0;\n"
+        "  $__t_start = microtime(true);\n"
+        "  if (function_exists('memory_reset_peak_usage')) memory_reset_peak_usage();\n"
+        "  $__m_start = memory_get_usage();\n"
+        "  try {\n"
+        "    if (($__desc['type'] ?? '') === 'closure_exec') {\n"
+        "      $__b64 = $__desc['bound_b64'] ?? '';\n"
+        "      if ($__b64 !== '') { $__b = @unserialize(base64_decode($__b64)); if (is_array($__b)) extract($__b); }\n"
+        "      ob_start();\n"
+        "      $__closure = eval('return ' . ($__desc['source'] ?? '') . ';');\n"
+        "      if (!is_callable($__closure)) { ob_end_clean(); $__out = ['task_id'=>$__tid,'success'=>false,'data'=>'eval did not return callable']; }\n"
+        "      else { $__ret = call_user_func_array($__closure, $__desc['args'] ?? []); $__outbuf = ob_get_clean(); $__out = ['task_id'=>$__tid,'success'=>true,'data'=>base64_encode(serialize(['return'=>$__ret,'output'=>$__outbuf]))]; }\n"
+        "    } else { $__out = ['task_id'=>$__tid,'success'=>false,'data'=>'unknown type']; }\n"
+        "  } catch (\\Throwable $__e) { while (ob_get_level() > 0) ob_end_clean(); $__out = ['task_id'=>$__tid,'success'=>false,'data'=>'exception: ' . $__e->getMessage()]; }\n"
+        /* CPU時間はプロセス全体のgetrusage()では測れないのでC側(RUSAGE_THREAD)で埋める */
+        "  $__out['ru'] = [(int) ((microtime(true) - $__t_start) * 1000000), 0, 0, max(0, memory_get_peak_usage() - $__m_start)];\n"
+        "  if (!empty($__desc['trace'])) { $__out['t_start'] = $__t_start; $__out['t_end'] = microtime(true); }\n"
+        "  return json_encode($__out);\n"
+        "}\n";
+
+static px_thread_slot *thread_slots = NULL;
+static int thread_count = 0;
+
+static int thread_request_startup(void) {
+    PG(expose_php) = 0;
+    PG(auto_globals_jit) = 1;
+    if (php_request_startup() != SUCCESS) return -1;
+    PG(during_request_startup) = 0;
+    SG(sapi_started) = 0;
+    SG(headers_sent) = 1;
+    SG(request_info).no_headers = 1;
+
+    int rc = 0;
+    zend_try {
+        if (zend_eval_stringl((char *) thread_bootstrap, sizeof(thread_bootstrap) - 1, NULL, "parallelx thread bootstrap") != SUCCESS) {
+            rc = -1;
+        }
+    } zend_catch {
+        rc = -1;
+    } zend_end_try();
+    return rc;
+}
+
+static void thread_fail(px_thread_slot *t, const char *message) {
+    char tmp[256];
+    int n = snprintf(tmp, sizeof(tmp), "{\"task_id\":%lu,\"success\":false,\"data\":\"%s\"}", t->task_id, message);
+    t->out = px_strdup(tmp);
+    t->out_len = t->out ? (size_t) n : 0;
+}
+
+static uint64_t thread_cpu_us(int sys) {
+#ifdef RUSAGE_THREAD
+    struct rusage ru;
+    if (getrusage(RUSAGE_THREAD, &ru) != 0) return 0;
+    struct timeval *tv = sys ? &ru.ru_stime : &ru.ru_utime;
+    return (uint64_t) tv->tv_sec * 1000000 + (uint64_t) tv->tv_usec;
+#else
+    (void) sys;
+    return 0;
+#endif
+}
+
+static void thread_run(px_thread_slot *t) {
+    int bailed = 0;
+    uint64_t user0 = thread_cpu_us(0), sys0 = thread_cpu_us(1);
+    zend_try {
+        zval fname, arg, ret;
+        ZVAL_STRINGL(&fname, PX_THREAD_RUN_FN, sizeof(PX_THREAD_RUN_FN) - 1);
+        ZVAL_STRINGL(&arg, t->in, t->in_len);
+        ZVAL_UNDEF(&ret);
+        if (call_user_function(NULL, NULL, &fname, &ret, 1, &arg) == SUCCESS && Z_TYPE(ret) == IS_STRING) {
+            t->out = (char *) malloc(Z_STRLEN(ret) + 1);
+            if (t->out) {
+                memcpy(t->out, Z_STRVAL(ret), Z_STRLEN(ret) + 1);
+                t->out_len = Z_STRLEN(ret);
+            }
+        }
+        zval_ptr_dtor(&fname);
+        zval_ptr_dtor(&arg);
+        if (!Z_ISUNDEF(ret)) zval_ptr_dtor(&ret);
+        if (EG(exception)) zend_clear_exception();
+    } zend_catch {
+        bailed = 1;
+    } zend_end_try();
+
+    if (bailed) {
+        thread_fail(t, "fatal error in thread worker");
+        /* bailout後のコンテキストは信用できないのでリクエストを作り直す */
+        php_request_shutdown(NULL);
+        thread_request_startup();
+    } else if (!t->out) {
+        thread_fail(t, "thread worker returned no result");
+    }
+    t->user_us = thread_cpu_us(0) - user0;
+    t->sys_us = thread_cpu_us(1) - sys0;
+}
+
+static void *thread_main(void *arg) {
+    px_thread_slot *t = (px_thread_slot *) arg;
+
+    ts_resource(0);
+    ZEND_TSRMLS_CACHE_UPDATE();
+    t->timed_out = &EG(timed_out);
+    t->vm_interrupt = &EG(vm_interrupt);
+    int ready = thread_request_startup() == 0;
+
+    while (1) {
+        sem_wait(&t->wake);
+        int st = atomic_load_explicit(&t->state, memory_order_acquire);
+        if (st == PX_THREAD_STOP) break;
+        if (st != PX_THREAD_TASK) continue;
+
+        if (ready) thread_run(t);
+        else thread_fail(t, "thread worker failed to start");
+        atomic_store_explicit(&t->state, PX_THREAD_DONE, memory_order_release);
+    }
+
+    php_request_shutdown(NULL);
+    ts_free_thread();
+    return NULL;
+}
+
+int px_spawn_threads(int count) {
+    if (count <= 0 || count > PARALLELX_MAX_WORKERS) return -1;
+    workers = (px_worker *) calloc(PARALLELX_MAX_WORKERS, sizeof(px_worker));
+    thread_slots = (px_thread_slot *) calloc(count, sizeof(px_thread_slot));
+    if (!workers || !thread_slots) goto thread_err;
+
+    int i;
+    for (i = 0; i < count; ++i) {
+        px_thread_slot *t = &thread_slots[i];
+        atomic_init(&t->state, PX_THREAD_IDLE);
+        if (sem_init(&t->wake, 0, 0) != 0) break;
+        if (pthread_create(&t->thread, NULL, thread_main, t) != 0) {
+            sem_destroy(&t->wake);
+            break;
+        }
+        workers[i].pid = -1;
+        workers[i].to_child = -1;
+        workers[i].from_child = -1;
+        workers[i].thread = t;
+    }
+    thread_count = i;
+    px_worker_count = i;
+    if (i == count) return 0;
+
+    px_thread_shutdown_all();
+thread_err:
+    free(workers);
+    free(thread_slots);
+    workers = NULL;
+    thread_slots = NULL;
+    px_worker_count = 0;
+    return -1;
+}
+
+int px_thread_send(px_worker *w, const char *json, size_t len, unsigned long tid) {
+    px_thread_slot *t = w->thread;
+    if (atomic_load_explicit(&t->state, memory_order_acquire) != PX_THREAD_IDLE) return -1;
+    /* スレッドは別のヒープを持つのでemallocのpayloadはそのまま渡せない */
+    char *in = (char *) malloc(len + 1);
+    if (!in) return -1;
+    memcpy(in, json, len);
+    in[len] = '\0';
+    t->in = in;
+    t->in_len = len;
+    t->task_id = tid;
+    atomic_store_explicit(&t->state, PX_THREAD_TASK, memory_order_release);
+    sem_post(&t->wake);
+
+    w->busy = 1;
+    w->current_task_id = tid;
+    px_stats.bytes_sent += len;
+    px_stats.frames_sent++;
+    return 0;
+}
+
+static void slot_reset(px_thread_slot *t) {
+    free(t->in);
+    free(t->out);
+    t->in = NULL;
+    t->out = NULL;
+    t->in_len = t->out_len = 0;
+    atomic_store_explicit(&t->state, PX_THREAD_IDLE, memory_order_release);
+}
+
+/* 完了した結果をprocess workerと同じフレーム形式でrecv_bufへ積む */
+void px_thread_collect(px_worker *w) {
+    px_thread_slot *t = w->thread;
+    if (atomic_load_explicit(&t->state, memory_order_acquire) != PX_THREAD_DONE) return;
+
+    size_t need = w->recv_used + 4 + t->out_len + 1;
+    if (need > w->recv_cap) {
+        size_t nc = w->recv_cap ? w->recv_cap : 8192;
+        while (nc < need) nc *= 2;
+        char *nb = (char *) realloc(w->recv_buf, nc);
+        if (!nb) {
+            /* 結果は捨ててスロットを空きに戻す。タスクはrestart側で失敗になる */
+            slot_reset(t);
+            w->dead = 1;
+            return;
+        }
+        w->recv_buf = nb;
+        w->recv_cap = nc;
+    }
+    uint32_t be = htonl((uint32_t) t->out_len);
+    memcpy(w->recv_buf + w->recv_used, &be, 4);
+    memcpy(w->recv_buf + w->recv_used + 4, t->out, t->out_len);
+    w->recv_used += 4 + t->out_len;
+    w->recv_buf[w->recv_used] = '\0';
+    px_stats.bytes_received += 4 + t->out_len;
+    w->thread_user_us = t->user_us;
+    w->thread_sys_us = t->sys_us;
+
+    slot_reset(t);
+}
+
+/* 実行中のタスクが終わるのをms待つ。0: 終わった */
+static int slot_wait_idle(px_thread_slot *t, int ms) {
+    for (int waited = 0; atomic_load_explicit(&t->state, memory_order_acquire) == PX_THREAD_TASK; ++waited) {
+        if (waited >= ms) return -1;
+        usleep(1000);
+    }
+    return 0;
+}
+
+/* max_execution_timeの超過と同じ経路でタスクを止める(次のopcodeでbailoutする) */
+static void slot_interrupt(px_thread_slot *t) {
+#if PHP_VERSION_ID >= 80200
+    zend_atomic_bool_store(t->timed_out, true);
+    zend_atomic_bool_store(t->vm_interrupt, true);
+#else
+    *t->timed_out = 1;
+    *t->vm_interrupt = 1;
+#endif
+}
+
+void px_thread_shutdown_all(void) {
+    int detached = 0;
+    for (int i = 0; i < thread_count; ++i) {
+        px_thread_slot *t = &thread_slots[i];
+        /* 実行中のタスクはしばらく待ち、終わらなければ割り込み、それでも駄目なら切り離す */
+        if (slot_wait_idle(t, PX_THREAD_STOP_MS) != 0) {
+            slot_interrupt(t);
+            if (slot_wait_idle(t, PX_THREAD_STOP_MS) != 0) {
+                php_error_docref(NULL, E_WARNING, "parallelx_shutdown: thread worker %d did not stop (task %lu); detaching it",
+                                 i, t->task_id);
+                pthread_detach(t->thread);
+                t->detached = 1;
+                detached++;
+                continue;
+            }
+        }
+        atomic_store_explicit(&t->state, PX_THREAD_STOP, memory_order_release);
+        sem_post(&t->wake);
+    }
+    for (int i = 0; i < thread_count; ++i) {
+        px_thread_slot *t = &thread_slots[i];
+        if (t->detached) continue;
+        pthread_join(t->thread, NULL);
+        sem_destroy(&t->wake);
+        free(t->in);
+        free(t->out);
+    }
+    /* 切り離したスレッドはまだスロットを触るので配列は手放さない */
+    if (!detached) free(thread_slots);
+    thread_slots = NULL;
+    thread_count = 0;
+}
+
+#else
+
+int px_spawn_threads(int count) {
+    (void) count;
+    return -1;
+}
+
+int px_thread_send(px_worker *w, const char *json, size_t len, unsigned long tid) {
+    (void) w;
+    (void) json;
+    (void) len;
+    (void) tid;
+    return -1;
+}
+
+void px_thread_collect(px_worker *w) {
+    (void) w;
+}
+
+void px_thread_shutdown_all(void) {}
+
+#endif /* ZTS */
@@ -0,0 +1,129 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "px_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* opt-inのタスクライフサイクルトレーサ。固定長リングバッファに記録し、Chrome/Perfetto形式で書き出す */
+
+int px_trace_enabled = 0;
+
+static px_trace_event *trace_ring = NULL;
+static size_t trace_cap = 0;
+static size_t trace_next = 0;
+static size_t trace_count = 0;
+/* CLOCK_REALTIME - CLOCK_MONOTONIC。workerが報告するmicrotime()との変換に使う */
+static int64_t trace_clock_offset_ns = 0;
+
+static const char *trace_kind_name(px_trace_kind kind) {
+    switch (kind) {
+        case PX_TRACE_SUBMIT: return "submit";
+        case PX_TRACE_ENCODE: return "encode";
+        case PX_TRACE_QUEUE: return "queued";
+        case PX_TRACE_DISPATCH: return "dispatch";
+        case PX_TRACE_EXECUTE: return "execute";
+        case PX_TRACE_RECEIVE: return "receive";
+        case PX_TRACE_DECODE: return "decode";
+        case PX_TRACE_CALLBACK: return "callback";
+    }
+    return "unknown";
+}
+
+int px_trace_enable(size_t capacity) {
+    if (capacity == 0) return -1;
+    px_trace_event *ring = (px_trace_event *) calloc(capacity, sizeof(px_trace_event));
+    if (!ring) return -1;
+    if (trace_ring) free(trace_ring);
+    trace_ring = ring;
+    trace_cap = capacity;
+    trace_next = 0;
+    trace_count = 0;
+
+    struct timespec rt;
+    clock_gettime(CLOCK_REALTIME, &rt);
+    uint64_t mono = px_now_ns();
+    trace_clock_offset_ns = (int64_t) ((uint64_t) rt.tv_sec * 1000000000ULL + (uint64_t) rt.tv_nsec) - (int64_t) mono;
+
+    px_trace_enabled = 1;
+    return 0;
+}
+
+void px_trace_disable(void) {
+    px_trace_enabled = 0;
+}
+
+void px_trace_record(px_trace_kind kind, unsigned long tid, int lane, uint64_t start_ns, uint64_t dur_ns) {
+    if (!px_trace_enabled || !trace_ring) return;
+    px_trace_event *ev = &trace_ring[trace_next];
+    ev->task_id = tid;
+    ev->kind = kind;
+    ev->lane = lane;
+    ev->start_ns = start_ns;
+    ev->dur_ns = dur_ns;
+    trace_next = (trace_next + 1) % trace_cap;
+    if (trace_count < trace_cap) trace_count++;
+}
+
+uint64_t px_trace_from_wall(double wall_seconds) {
+    int64_t ns = (int64_t) (wall_seconds * 1e9) - trace_clock_offset_ns;
+    return ns > 0 ? (uint64_t) ns : 0;
+}
+
+static double trace_ts_us(uint64_t mono_ns) {
+    return (double) ((int64_t) mono_ns + trace_clock_offset_ns) / 1000.0;
+}
+
+long px_trace_dump(const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) return -1;
+
+    int pid = (int) getpid();
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"parallelx\"}}", pid);
+    fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"main\"}}", pid);
+    for (int i = 0; i < px_worker_count; ++i) {
+        fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"worker #%d\"}}",
+                pid, i + 1, i);
+    }
+
+    size_t first = (trace_next + trace_cap - trace_count) % (trace_cap ? trace_cap : 1);
+    for (size_t n = 0; n < trace_count; ++n) {
+        const px_trace_event *ev = &trace_ring[(first + n) % trace_cap];
+        const char *name = trace_kind_name(ev->kind);
+        double ts = trace_ts_us(ev->start_ns);
+        switch (ev->kind) {
+            case PX_TRACE_QUEUE:
+                /* 待ち時間はタスク同士が重なるのでasyncイベントで出す */
+                fprintf(fp,
+                        ",\n{\"name\":\"%s\",\"cat\":\"task\",\"ph\":\"b\",\"id\":%lu,\"ts\":%.3f,\"pid\":%d,\"tid\":0}",
+                        name, ev->task_id, ts, pid);
+                fprintf(fp,
+                        ",\n{\"name\":\"%s\",\"cat\":\"task\",\"ph\":\"e\",\"id\":%lu,\"ts\":%.3f,\"pid\":%d,\"tid\":0}",
+                        name, ev->task_id, trace_ts_us(ev->start_ns + ev->dur_ns), pid);
+                break;
+            case PX_TRACE_SUBMIT:
+            case PX_TRACE_DISPATCH:
+            case PX_TRACE_RECEIVE:
+                fprintf(fp,
+                        ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,"
+                        "\"args\":{\"task_id\":%lu}}",
+                        name, ts, pid, ev->lane + 1, ev->task_id);
+                break;
+            default:
+                fprintf(fp,
+                        ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+                        "\"args\":{\"task_id\":%lu}}",
+                        name, ts, (double) ev->dur_ns / 1000.0, pid, ev->lane + 1, ev->task_id);
+                break;
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    if (fclose(fp) != 0) return -1;
+    return (long) trace_count;
+}
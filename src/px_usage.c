@@ -0,0 +1,53 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "px_internal.h"
+
+/*
+ * tokenごとのリソース集計。workerが結果フレームに載せる
+ * "ru": [wall_us, user_us, sys_us, mem_peak_bytes] を足し込む。
+ * threadバックエンドのCPU時間はスレッド単位で測った値(px_thread.c)で置き換える
+ */
+
+static uint64_t ru_field(HashTable *ru, zend_ulong i) {
+    zval *z = zend_hash_index_find(ru, i);
+    if (!z) return 0;
+    zend_long v = Z_TYPE_P(z) == IS_LONG ? Z_LVAL_P(z) : zval_get_long(z);
+    return v > 0 ? (uint64_t) v : 0;
+}
+
+/* 結果を受け取ったworkerから呼ぶ(releaseの前)。tokenの無いタスクや古いworker scriptは数えない */
+void px_usage_record(px_worker *w, zval *result) {
+    px_usage *u = w->usage;
+    if (!u || Z_TYPE_P(result) != IS_ARRAY) return;
+    zval *zru = zend_hash_str_find(Z_ARRVAL_P(result), "ru", sizeof("ru") - 1);
+    if (!zru || Z_TYPE_P(zru) != IS_ARRAY) return;
+    HashTable *ru = Z_ARRVAL_P(zru);
+
+    uint64_t mem = ru_field(ru, 3);
+    u->tasks++;
+    u->wall_us += ru_field(ru, 0);
+    if (w->thread) {
+        u->user_us += w->thread_user_us;
+        u->sys_us += w->thread_sys_us;
+    } else {
+        u->user_us += ru_field(ru, 1);
+        u->sys_us += ru_field(ru, 2);
+    }
+    u->mem_peak_sum += mem;
+    if (mem > u->mem_peak_max) u->mem_peak_max = mem;
+}
+
+void px_usage_to_array(px_usage *u, zval *out) {
+    array_init(out);
+    add_assoc_long(out, "tasks", (zend_long) u->tasks);
+    add_assoc_long(out, "wall_us", (zend_long) u->wall_us);
+    add_assoc_long(out, "user_us", (zend_long) u->user_us);
+    add_assoc_long(out, "sys_us", (zend_long) u->sys_us);
+    add_assoc_long(out, "cpu_us", (zend_long) (u->user_us + u->sys_us));
+    add_assoc_long(out, "avg_wall_us", u->tasks ? (zend_long) (u->wall_us / u->tasks) : 0);
+    add_assoc_long(out, "avg_cpu_us", u->tasks ? (zend_long) ((u->user_us + u->sys_us) / u->tasks) : 0);
+    add_assoc_long(out, "mem_peak_avg", u->tasks ? (zend_long) (u->mem_peak_sum / u->tasks) : 0);
+    add_assoc_long(out, "mem_peak_max", (zend_long) u->mem_peak_max);
+}
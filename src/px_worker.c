@@ -45,12 +45,13 @@ int px_create_worker_script_if_missing(const char *user_script) {
     }
 
     char template[] = WORKER_TEMPLATE;
-    int fd = mkstemp(template);
+    int fd = mkstemps(template, 3);
     if (fd < 0) return -1;
     const char *script =
             "<?php\n"
             "$autoload = getenv('" ENV_AUTLOAD "');\n"
             "if ($autoload !== false && file_exists($autoload)) { @require_once $autoload; }\n"
+            "function px_cpu_us(array $r, string $k): int { return $r[\"ru_$k.tv_sec\"] * 1000000 + $r[\"ru_$k.tv_usec\"]; }\n"
             "while (!feof(STDIN)) {\n"
             "  $len_bytes = fread(STDIN, 4);\n"
             "  if ($len_bytes === false || strlen($len_bytes) < 4) break;\n"
@@ -67,6 +68,9 @@ int px_create_worker_script_if_missing(const char *user_script) {
             "  if (!is_array($desc)) { $out = ['task_id'=>0,'success'=>false,'data'=>'invalid descriptor']; }\n"
             "  else {\n"
             "    $tid = $desc['task_id'] ?? 0;\n"
+            "    $t_start = microtime(true); $ru0 = getrusage();\n"
+            "    if (function_exists('memory_reset_peak_usage')) memory_reset_peak_usage();\n"
+            "    $m0 = memory_get_usage();\n"
             "    try {\n"
             "      if (($desc['type'] ?? '') === 'closure_exec') {\n"
             "        $src = $desc['source'] ?? '';\n"
@@ -79,6 +83,10 @@ int px_create_worker_script_if_missing(const char *user_script) {
             "        else { $ret = call_user_func_array($closure, $args); $outbuf = ob_get_clean(); $payload = ['return'=>$ret,'output'=>$outbuf]; $out = ['task_id'=>$tid,'success'=>true,'data'=>base64_encode(serialize($payload))]; }\n"
             "      } else { $out = ['task_id'=>($desc['task_id'] ?? 0),'success'=>false,'data'=>'unknown type']; }\n"
             "    } catch (Throwable $e) { $out = ['task_id'=>$tid,'success'=>false,'data'=>'exception: ' . $e->getMessage()]; }\n"
+            "    $ru1 = getrusage();\n"
+            "    $out['ru'] = [(int) ((microtime(true) - $t_start) * 1000000), px_cpu_us($ru1, 'utime') - px_cpu_us($ru0, 'utime'),\n"
+            "      px_cpu_us($ru1, 'stime') - px_cpu_us($ru0, 'stime'), max(0, memory_get_peak_usage() - $m0)];\n"
+            "    if (!empty($desc['trace'])) { $out['t_start'] = $t_start; $out['t_end'] = microtime(true); }\n"
             "  }\n"
             "  $json = json_encode($out);\n"
             "  $len2 = strlen($json);\n"
@@ -96,49 +104,63 @@ int px_create_worker_script_if_missing(const char *user_script) {
     return 0;
 }
 
+/* パイプ容量を広げる(権限や上限で失敗しても既定の64KBのまま続行) */
+static void tune_pipe(int fd) {
+#ifdef F_SETPIPE_SZ
+    if (fcntl(fd, F_SETPIPE_SZ, PX_PIPE_SIZE) < 0) {
+        (void) fcntl(fd, F_SETPIPE_SZ, PX_PIPE_SIZE / 4);
+    }
+#else
+    (void) fd;
+#endif
+}
+
+/* php workerをfork/execしてwのパイプを設定する */
+static int spawn_process(px_worker *w) {
+    int p2c[2], c2p[2];
+    if (pipe(p2c) < 0) return -1;
+    if (pipe(c2p) < 0) {
+        close(p2c[0]);
+        close(p2c[1]);
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(p2c[0]);
+        close(p2c[1]);
+        close(c2p[0]);
+        close(c2p[1]);
+        return -1;
+    } else if (pid == 0) {
+        dup2(p2c[0], STDIN_FILENO);
+        dup2(c2p[1], STDOUT_FILENO);
+        close(p2c[0]);
+        close(p2c[1]);
+        close(c2p[0]);
+        close(c2p[1]);
+        execl(php_cli_path, php_cli_path, worker_script_path, (char *) NULL);
+        _exit(127);
+    }
+    close(p2c[0]);
+    close(c2p[1]);
+    w->pid = pid;
+    w->to_child = p2c[1];
+    w->from_child = c2p[0];
+    tune_pipe(w->to_child);
+    tune_pipe(w->from_child);
+    set_nonblocking(w->to_child);
+    set_nonblocking(w->from_child);
+    return 0;
+}
+
 int px_spawn_workers(int count) {
     if (count <= 0 || count > PARALLELX_MAX_WORKERS) return -1;
-    workers = (px_worker *) calloc(count, sizeof(px_worker));
+    /* parallelx_add_remote() で後からslotを足せるよう上限分確保しておく */
+    workers = (px_worker *) calloc(PARALLELX_MAX_WORKERS, sizeof(px_worker));
     if (!workers) return -1;
     int i;
     for (i = 0; i < count; ++i) {
-        int p2c[2], c2p[2];
-        if (pipe(p2c) < 0) goto spawn_err;
-        if (pipe(c2p) < 0) {
-            close(p2c[0]);
-            close(p2c[1]);
-            goto spawn_err;
-        }
-        pid_t pid = fork();
-        if (pid < 0) {
-            close(p2c[0]);
-            close(p2c[1]);
-            close(c2p[0]);
-            close(c2p[1]);
-            goto spawn_err;
-        } else if (pid == 0) {
-            dup2(p2c[0], STDIN_FILENO);
-            dup2(c2p[1], STDOUT_FILENO);
-            close(p2c[0]);
-            close(p2c[1]);
-            close(c2p[0]);
-            close(c2p[1]);
-            execl(php_cli_path, php_cli_path, worker_script_path, (char *) NULL);
-            _exit(127);
-        } else {
-            close(p2c[0]);
-            close(c2p[1]);
-            workers[i].pid = pid;
-            workers[i].to_child = p2c[1];
-            workers[i].from_child = c2p[0];
-            workers[i].recv_buf = NULL;
-            workers[i].recv_cap = 0;
-            workers[i].recv_used = 0;
-            workers[i].busy = 0;
-            workers[i].current_task_id = 0;
-            workers[i].dead = 0;
-            set_nonblocking(workers[i].from_child);
-        }
+        if (spawn_process(&workers[i]) != 0) goto spawn_err;
     }
     px_worker_count = count;
     return 0;
@@ -154,27 +176,169 @@ spawn_err:
     return -1;
 }
 
+/*
+ * parallelx_reload() の切り替え待ち。新しい世代のworkerが1つタスクを返すまでは旧世代も
+ * そのまま使い、その前に新しい世代が落ちたら(php_cliがworkerとして動かない等)旧設定へ戻す
+ */
+static struct {
+    int pending;
+    char php_cli[PATH_MAX];
+    char script[PATH_MAX];
+    char *autoload; /* NULLなら未設定 */
+} reload;
+
+/* 控えておいた設定と現在の設定を入れ替える */
+static void reload_swap_config(void) {
+    char tmp[PATH_MAX];
+    memcpy(tmp, php_cli_path, PATH_MAX);
+    memcpy(php_cli_path, reload.php_cli, PATH_MAX);
+    memcpy(reload.php_cli, tmp, PATH_MAX);
+    memcpy(tmp, worker_script_path, PATH_MAX);
+    memcpy(worker_script_path, reload.script, PATH_MAX);
+    memcpy(reload.script, tmp, PATH_MAX);
+    const char *env = getenv(ENV_AUTLOAD);
+    char *cur = env ? px_strdup(env) : NULL;
+    if (reload.autoload) setenv(ENV_AUTLOAD, reload.autoload, 1);
+    else unsetenv(ENV_AUTLOAD);
+    free(reload.autoload);
+    reload.autoload = cur;
+}
+
+static void reload_clear(void) {
+    free(reload.autoload);
+    reload.autoload = NULL;
+    reload.pending = 0;
+}
+
+static int is_new_generation(const px_worker *w) {
+    return !w->remote && !w->thread && w->generation == px_generation;
+}
+
+/* 旧設定を預かって切り替え待ちに入る。old_autoloadの所有権も移る */
+void px_reload_begin(const char *old_cli, const char *old_script, char *old_autoload) {
+    memcpy(reload.php_cli, old_cli, PATH_MAX);
+    memcpy(reload.script, old_script, PATH_MAX);
+    free(reload.autoload);
+    reload.autoload = old_autoload;
+    reload.pending = 1;
+}
+
+int px_reload_pending(void) {
+    return reload.pending;
+}
+
+/* 切り替え待ちの新しい世代のworkerか */
+int px_reload_unconfirmed(const px_worker *w) {
+    return reload.pending && is_new_generation(w);
+}
+
+/* 新しい世代のworkerが結果を返したら旧世代を退役に回す */
+void px_reload_confirm(px_worker *w) {
+    if (!reload.pending || !is_new_generation(w)) return;
+    reload_clear();
+    for (int i = 0; i < px_worker_count; ++i) {
+        px_worker *o = &workers[i];
+        if (o->retired || o->draining || o->remote || o->thread || o->generation == px_generation) continue;
+        o->draining = 1;
+        if (!o->busy) px_worker_retire(o);
+    }
+}
+
+/* 1往復する前に新しい世代が落ちた: 旧設定に戻して新しい世代を退役させる */
+static void reload_abort(void) {
+    reload_swap_config();
+    reload_clear();
+    for (int i = 0; i < px_worker_count; ++i) {
+        px_worker *w = &workers[i];
+        if (!w->retired && is_new_generation(w)) w->draining = 1;
+    }
+    php_error_docref(NULL, E_WARNING,
+                     "parallelx_reload: new workers exited before completing a task; keeping the previous generation");
+}
+
+void px_reload_free(void) {
+    reload_clear();
+}
+
 px_worker *px_find_idle_worker(void) {
-    for (int i = 0; i < px_worker_count; ++i) if (!workers[i].busy && !workers[i].dead) return &workers[i];
-    return NULL;
+    px_worker *found = NULL;
+    for (int i = 0; i < px_worker_count; ++i) {
+        px_worker *w = &workers[i];
+        if (w->busy || w->dead || w->draining || w->retired) continue;
+        /* 切り替え待ちの間は新しい世代を優先して早く1往復させる */
+        if (!reload.pending || is_new_generation(w)) return w;
+        if (!found) found = w;
+    }
+    return found;
+}
+
+/* タスクの完了/失敗でworkerを空きに戻し、ownerの実行中数を減らす */
+void px_worker_release(px_worker *w) {
+    if (w->busy && w->owner && w->owner->inflight > 0) w->owner->inflight--;
+    w->owner = NULL;
+    w->exec_hist = NULL;
+    w->usage = NULL;
+    w->busy = 0;
+    w->current_task_id = 0;
+    if (w->retry) {
+        if (w->retry->payload) efree(w->retry->payload);
+        free(w->retry);
+        w->retry = NULL;
+    }
+}
+
+/* 送信バッファに溜まっている分を書けるだけ書く。0: 完了/書き込み待ち, -1: パイプ切断 */
+int px_flush_worker(px_worker *w) {
+    while (w->send_off < w->send_len) {
+        ssize_t n = write(w->to_child, w->send_buf + w->send_off, w->send_len - w->send_off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            w->dead = 1;
+            return -1;
+        }
+        w->send_off += (size_t) n;
+        px_stats.bytes_sent += (uint64_t) n;
+    }
+    w->send_off = 0;
+    w->send_len = 0;
+    return 0;
 }
 
+/* フレームを送信バッファに積んで即座に書けるだけ書く。残りはparallelx_pollで流す */
 int px_send_to_worker(px_worker *w, const char *json, size_t len, unsigned long tid) {
-    uint32_t be = htonl((uint32_t) len);
-    if (write_all(w->to_child, &be, 4) != 4) {
-        w->dead = 1;
-        return -1;
+    if (w->thread) return px_thread_send(w, json, len, tid);
+
+    size_t need = w->send_len + 4 + len;
+    if (need > w->send_cap) {
+        size_t nc = w->send_cap ? w->send_cap : 8192;
+        while (nc < need) nc *= 2;
+        char *nb = (char *) realloc(w->send_buf, nc);
+        if (!nb) return -1;
+        w->send_buf = nb;
+        w->send_cap = nc;
     }
-    if (write_all(w->to_child, json, len) != (ssize_t) len) {
-        w->dead = 1;
+    uint32_t be = htonl((uint32_t) len);
+    memcpy(w->send_buf + w->send_len, &be, 4);
+    memcpy(w->send_buf + w->send_len + 4, json, len);
+    w->send_len += 4 + len;
+
+    if (px_flush_worker(w) != 0) {
+        w->send_len = 0;
+        w->send_off = 0;
         return -1;
     }
     w->busy = 1;
     w->current_task_id = tid;
+    px_stats.frames_sent++;
     return 0;
 }
 
 void px_read_from_worker(px_worker *w) {
+    if (w->thread) {
+        px_thread_collect(w);
+        return;
+    }
     char tmp[4096];
     ssize_t n;
     while ((n = read(w->from_child, tmp, sizeof(tmp))) > 0) {
@@ -191,6 +355,7 @@ void px_read_from_worker(px_worker *w) {
         }
         memcpy(w->recv_buf + w->recv_used, tmp, (size_t) n);
         w->recv_used += (size_t) n;
+        px_stats.bytes_received += (uint64_t) n;
         w->recv_buf[w->recv_used] = '\0';
     }
     if (n == 0) {
@@ -219,6 +384,7 @@ int px_try_extract(px_worker *w, char **payload_out, size_t *len_out) {
     size_t rem = w->recv_used - (4 + (size_t) len);
     if (rem) memmove(w->recv_buf, w->recv_buf + 4 + (size_t) len, rem);
     w->recv_used = rem;
+    px_stats.frames_received++;
     *payload_out = payload;
     *len_out = (size_t) len;
     return 1;
@@ -228,9 +394,30 @@ int px_restart_worker(int idx) {
     if (!workers || idx < 0 || idx >= px_worker_count) return -1;
     px_worker *w = &workers[idx];
 
-    if (w->busy && w->current_task_id) {
-        px_fail_task(w->current_task_id, "worker restarted");
+    px_worker_abandon(w, "worker restarted");
+    if (reload.pending && is_new_generation(w)) reload_abort();
+    /* 置き換え中の旧世代は作り直さずに退役させる */
+    if (w->draining) {
+        px_worker_release(w);
+        px_worker_retire(w);
+        return 0;
+    }
+    /* remoteは非同期につなぎ直し、つながった時点で再起動として数える(parallelx.c) */
+    if (w->remote) {
+        px_worker_release(w);
+        return px_remote_reconnect(w);
+    }
+    px_stats.worker_restarts++;
+    px_stats.workers[idx].restarts++;
+
+    if (w->thread) {
+        /* スレッドは作り直せないので受信状態だけ捨てる */
+        w->recv_used = 0;
+        px_worker_release(w);
+        w->dead = 0;
+        return 0;
     }
+    px_worker_release(w);
 
     if (w->pid > 0) {
         kill(w->pid, SIGKILL);
@@ -239,51 +426,87 @@ int px_restart_worker(int idx) {
     if (w->to_child > 0) close(w->to_child);
     if (w->from_child > 0) close(w->from_child);
     if (w->recv_buf) free(w->recv_buf);
+    if (w->send_buf) free(w->send_buf);
 
+    int generation = w->generation;
     memset(w, 0, sizeof(*w));
     w->to_child = -1;
     w->from_child = -1;
     w->pid = -1;
     w->dead = 0;
+    w->generation = generation;
 
-    int p2c[2], c2p[2];
-    if (pipe(p2c) < 0) return -1;
-    if (pipe(c2p) < 0) {
-        close(p2c[0]);
-        close(p2c[1]);
-        return -1;
+    int rc;
+    if (reload.pending && generation != px_generation) {
+        /* 切り替え待ちの旧世代は旧設定のまま起動し直す */
+        reload_swap_config();
+        rc = spawn_process(w);
+        reload_swap_config();
+    } else {
+        rc = spawn_process(w);
     }
+    return rc != 0 ? -1 : 0;
+}
 
-    pid_t pid = fork();
-    if (pid < 0) {
-        close(p2c[0]);
-        close(p2c[1]);
-        close(c2p[0]);
-        close(c2p[1]);
-        return -1;
-    } else if (pid == 0) {
-        dup2(p2c[0], STDIN_FILENO);
-        dup2(c2p[1], STDOUT_FILENO);
-        close(p2c[0]);
-        close(p2c[1]);
-        close(c2p[0]);
-        close(c2p[1]);
-        execl(php_cli_path, php_cli_path, worker_script_path, (char *) NULL);
-        _exit(127);
+/* 退役させてまだ終わっていないworkerのpid。pollのたびにWNOHANGで回収する */
+static pid_t reaping[PARALLELX_MAX_WORKERS];
+static int reaping_count = 0;
+
+void px_worker_reap(int block) {
+    int k = 0;
+    for (int i = 0; i < reaping_count; ++i) {
+        if (waitpid(reaping[i], NULL, block ? 0 : WNOHANG) == 0) reaping[k++] = reaping[i];
     }
+    reaping_count = k;
+}
 
-    close(p2c[0]);
-    close(c2p[1]);
-    w->pid = pid;
-    w->to_child = p2c[1];
-    w->from_child = c2p[0];
-    w->busy = 0;
-    w->current_task_id = 0;
-    w->recv_buf = NULL;
-    w->recv_used = 0;
-    w->recv_cap = 0;
-    w->dead = 0;
-    set_nonblocking(w->from_child);
-    return 0;
+/* 実行中のタスクが無いworkerを止めてslotを空ける。stdinを閉じればworkerのループは抜ける */
+void px_worker_retire(px_worker *w) {
+    if (w->to_child >= 0) close(w->to_child);
+    if (w->from_child >= 0) close(w->from_child);
+    if (w->pid > 0) {
+        kill(w->pid, SIGTERM);
+        if (waitpid(w->pid, NULL, WNOHANG) == 0) {
+            /* 控えが溢れたときだけその場で待つ */
+            if (reaping_count < PARALLELX_MAX_WORKERS) reaping[reaping_count++] = w->pid;
+            else waitpid(w->pid, NULL, 0);
+        }
+    }
+    if (w->recv_buf) free(w->recv_buf);
+    if (w->send_buf) free(w->send_buf);
+    memset(w, 0, sizeof(*w));
+    w->pid = -1;
+    w->to_child = -1;
+    w->from_child = -1;
+    w->retired = 1;
+}
+
+int px_worker_free_slots(void) {
+    int n = PARALLELX_MAX_WORKERS - px_worker_count;
+    for (int i = 0; i < px_worker_count; ++i) if (workers[i].retired) n++;
+    return n;
+}
+
+/* 現在の php_cli_path / worker_script_path で count 個のworkerを起動する。空きslotを優先して使う */
+int px_spawn_generation(int count) {
+    int spawned = 0;
+    for (int i = 0; i < PARALLELX_MAX_WORKERS && spawned < count; ++i) {
+        if (i < px_worker_count && !workers[i].retired) continue;
+        px_worker *w = &workers[i];
+        memset(w, 0, sizeof(*w));
+        w->pid = -1;
+        w->to_child = -1;
+        w->from_child = -1;
+        if (spawn_process(w) != 0) {
+            w->retired = 1;
+            if (i >= px_worker_count) px_worker_count = i + 1;
+            break;
+        }
+        w->generation = px_generation;
+        memset(&px_stats.workers[i], 0, sizeof(px_stats.workers[i]));
+        if (i >= px_worker_count) px_worker_count = i + 1;
+        spawned++;
+    }
+    return spawned;
 }
 
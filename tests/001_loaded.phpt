@@ -0,0 +1,23 @@
+--TEST--
+parallelx: extension is loaded and functions are registered
+--EXTENSIONS--
+parallelx
+--FILE--
+<?php
+var_dump(extension_loaded('parallelx'));
+foreach (['parallelx_init', 'parallelx_register', 'parallelx_submit_token', 'parallelx_submit_desc',
+          'parallelx_poll', 'parallelx_shutdown', 'parallelx_stats'] as $fn) {
+    var_dump(function_exists($fn));
+}
+var_dump(parallelx_poll());
+?>
+--EXPECT--
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(false)
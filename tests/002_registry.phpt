@@ -0,0 +1,27 @@
+--TEST--
+parallelx: registry tokens and unknown token handling
+--EXTENSIONS--
+parallelx
+--FILE--
+<?php
+require __DIR__ . '/px_test.inc';
+
+var_dump(@parallelx_register('function() { return 1; }'));
+
+px_test_init(1);
+$a = parallelx_register('function() { return 1; }');
+$b = parallelx_register('function() { return 2; }', base64_encode(serialize(['x' => 1])));
+var_dump(is_string($a), is_string($b), $a !== $b);
+
+var_dump(parallelx_submit_token('px_tok_missing', [], function() {}));
+var_dump(parallelx_shutdown());
+?>
+--EXPECTF--
+bool(false)
+bool(true)
+bool(true)
+bool(true)
+
+Warning: parallelx_submit_token(): parallelx_submit_token: token not found in %s on line %d
+bool(false)
+bool(true)
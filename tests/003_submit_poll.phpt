@@ -0,0 +1,28 @@
+--TEST--
+parallelx: submit_token result is delivered through poll
+--EXTENSIONS--
+parallelx
+--FILE--
+<?php
+require __DIR__ . '/px_test.inc';
+
+px_test_init(2, null);
+$token = parallelx_register('function($n) use ($k) { echo "hi"; return $n * $k; }', base64_encode(serialize(['k' => 3])));
+
+$done = 0;
+var_dump(parallelx_submit_token($token, [14], function($res) use (&$done) {
+    var_dump($res['success']);
+    $payload = unserialize(base64_decode($res['data']));
+    var_dump($payload['return'], $payload['output']);
+    $done++;
+}));
+var_dump(px_test_wait($done, 1));
+var_dump(parallelx_shutdown());
+?>
+--EXPECT--
+bool(true)
+bool(true)
+int(42)
+string(2) "hi"
+bool(true)
+bool(true)
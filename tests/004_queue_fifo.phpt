@@ -0,0 +1,39 @@
+--TEST--
+parallelx: tasks beyond worker capacity are queued and drained in order
+--EXTENSIONS--
+parallelx
+--FILE--
+<?php
+require __DIR__ . '/px_test.inc';
+
+px_test_init(1);
+$token = parallelx_register('function($i) { return $i; }');
+
+$order = [];
+$done = 0;
+for ($i = 0; $i < 20; ++$i) {
+    parallelx_submit_token($token, [$i], function($res) use (&$order, &$done) {
+        $order[] = px_test_return($res);
+        $done++;
+    });
+}
+$stats = parallelx_stats();
+var_dump($stats['queue']['depth'] === 19, $stats['queue']['running'] === 1);
+
+var_dump(px_test_wait($done, 20));
+var_dump($order === range(0, 19));
+
+$stats = parallelx_stats();
+var_dump($stats['tasks']['submitted'], $stats['tasks']['completed'], $stats['queue']['depth']);
+var_dump($stats['latency_us']['end_to_end']['count']);
+parallelx_shutdown();
+?>
+--EXPECT--
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+int(20)
+int(20)
+int(0)
+int(20)
@@ -0,0 +1,51 @@
+--TEST--
+parallelx: unknown descriptor types, exceptions and dead workers fail the task
+--EXTENSIONS--
+parallelx
+--FILE--
+<?php
+require __DIR__ . '/px_test.inc';
+
+px_test_init(1);
+$done = 0;
+$report = function($res) use (&$done) {
+    var_dump($res['success'], $res['data']);
+    $done++;
+};
+
+parallelx_submit_desc(['type' => 'nope'], $report);
+px_test_wait($done, 1);
+
+$throws = parallelx_register('function() { throw new RuntimeException("boom"); }');
+parallelx_submit_token($throws, [], $report);
+px_test_wait($done, 2);
+
+$dies = parallelx_register('function() { exit(1); }');
+parallelx_submit_token($dies, [], $report);
+px_test_wait($done, 3);
+
+$ok = parallelx_register('function() { return "alive"; }');
+parallelx_submit_token($ok, [], function($res) use (&$done) {
+    var_dump(px_test_return($res));
+    $done++;
+});
+px_test_wait($done, 4);
+
+$stats = parallelx_stats();
+var_dump($stats['worker_restarts'] >= 1, $stats['tasks']['failed']);
+/* ownerの完了数には結果が返ったものだけ、落ちたworkerのタスクは失敗数へ */
+var_dump($stats['owners']['default']['completed'], $stats['owners']['default']['failed']);
+parallelx_shutdown();
+?>
+--EXPECT--
+bool(false)
+string(12) "unknown type"
+bool(false)
+string(15) "exception: boom"
+bool(false)
+string(11) "worker died"
+string(5) "alive"
+bool(true)
+int(1)
+int(3)
+int(1)
@@ -0,0 +1,37 @@
+--TEST--
+parallelx: workers fill shared-memory buffers in place
+--EXTENSIONS--
+parallelx
+--FILE--
+<?php
+require __DIR__ . '/px_test.inc';
+
+px_test_init(1);
+$buf = parallelx_shm_alloc('int32', 8);
+var_dump($buf['type'], $buf['length'], $buf['elem_size']);
+
+$token = parallelx_register('function($h) {
+    $fp = fopen($h["path"], "r+b");
+    fwrite($fp, pack("l*", ...range(-4, 3)));
+    fclose($fp);
+    return true;
+}');
+$done = 0;
+parallelx_submit_token($token, [$buf], function($res) use (&$done) { $done++; });
+px_test_wait($done, 1);
+
+var_dump(parallelx_shm_unpack($buf) === range(-4, 3));
+var_dump(strlen(parallelx_shm_read($buf)));
+var_dump(parallelx_shm_free($buf), parallelx_shm_free($buf));
+var_dump(@parallelx_shm_alloc('int64', 8));
+parallelx_shutdown();
+?>
+--EXPECT--
+string(5) "int32"
+int(8)
+int(4)
+bool(true)
+int(32)
+bool(true)
+bool(false)
+bool(false)
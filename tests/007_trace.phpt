@@ -0,0 +1,54 @@
+--TEST--
+parallelx: trace dump produces Chrome trace events
+--EXTENSIONS--
+parallelx
+--FILE--
+<?php
+require __DIR__ . '/px_test.inc';
+
+px_test_init(1);
+var_dump(parallelx_trace_enable(1024));
+$token = parallelx_register('function() { return 1; }');
+$done = 0;
+parallelx_submit_token($token, [], function($res) use (&$done) { $done++; });
+px_test_wait($done, 1);
+parallelx_trace_disable();
+
+$path = sys_get_temp_dir() . '/parallelx_trace_' . getmypid() . '.json';
+var_dump(parallelx_trace_dump($path) > 0);
+$trace = json_decode(file_get_contents($path), true);
+$names = array_unique(array_column($trace['traceEvents'], 'name'));
+foreach (['submit', 'encode', 'queued', 'dispatch', 'execute', 'receive', 'decode', 'callback'] as $n) {
+    var_dump(in_array($n, $names, true));
+}
+unlink($path);
+
+/* trace無効のときも、呼び出し側が付けたtraceキーはそのままworkerへ届き、descからも消えない */
+$desc = ['type' => 'nope', 'trace' => true];
+$seen = null;
+parallelx_submit_desc($desc, function($res) use (&$seen, &$done) {
+    $seen = $res;
+    $done++;
+});
+px_test_wait($done, 2);
+var_dump(isset($seen['t_start'], $seen['t_end']), $desc);
+parallelx_shutdown();
+?>
+--EXPECT--
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+array(2) {
+  ["type"]=>
+  string(4) "nope"
+  ["trace"]=>
+  bool(true)
+}
@@ -0,0 +1,33 @@
+--TEST--
+parallelx: payloads larger than the pipe buffer are drained across polls
+--EXTENSIONS--
+parallelx
+--FILE--
+<?php
+require __DIR__ . '/px_test.inc';
+
+px_test_init(2);
+$token = parallelx_register('function($s) { return [strlen($s), md5($s)]; }');
+
+$payloads = [str_repeat('a', 3 * 1024 * 1024), random_bytes(16) . str_repeat('b', 5 * 1024 * 1024)];
+$payloads[1] = base64_encode($payloads[1]);
+$results = [];
+$done = 0;
+foreach ($payloads as $i => $p) {
+    parallelx_submit_token($token, [$p], function($res) use ($i, &$results, &$done) {
+        $results[$i] = px_test_return($res);
+        $done++;
+    });
+}
+var_dump(px_test_wait($done, 2, 30.0));
+foreach ($payloads as $i => $p) {
+    var_dump($results[$i] === [strlen($p), md5($p)]);
+}
+var_dump(parallelx_stats()['io']['frames_sent']);
+parallelx_shutdown();
+?>
+--EXPECT--
+bool(true)
+bool(true)
+bool(true)
+int(2)
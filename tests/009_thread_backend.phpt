@@ -0,0 +1,44 @@
+--TEST--
+parallelx: thread backend runs closures in-process on ZTS builds
+--EXTENSIONS--
+parallelx
+--SKIPIF--
+<?php if (!PHP_ZTS) die('skip requires ZTS'); ?>
+--FILE--
+<?php
+require __DIR__ . '/px_test.inc';
+
+var_dump(parallelx_init(2, null, null, null, 'thread'));
+$token = parallelx_register('function($a, $b) use ($c) { echo "out"; return $a + $b + $c; }', base64_encode(serialize(['c' => 100])));
+$throws = parallelx_register('function() { throw new LogicException("nope"); }');
+
+$results = [];
+$done = 0;
+for ($i = 0; $i < 8; ++$i) {
+    parallelx_submit_token($token, [$i, $i], function($res) use ($i, &$results, &$done) {
+        $results[$i] = unserialize(base64_decode($res['data']));
+        $done++;
+    });
+}
+parallelx_submit_token($throws, [], function($res) use (&$done) {
+    var_dump($res['success'], $res['data']);
+    $done++;
+});
+var_dump(px_test_wait($done, 9));
+ksort($results);
+var_dump(array_column($results, 'return') === [100, 102, 104, 106, 108, 110, 112, 114]);
+var_dump($results[0]['output']);
+var_dump(parallelx_submit_fork(fn() => 1, []));
+var_dump(parallelx_shutdown());
+?>
+--EXPECTF--
+bool(true)
+bool(false)
+string(15) "exception: nope"
+bool(true)
+bool(true)
+string(3) "out"
+
+Warning: parallelx_submit_fork(): parallelx_submit_fork: fork mode cannot be used with the thread backend in %s on line %d
+bool(false)
+bool(true)
@@ -0,0 +1,75 @@
+--TEST--
+parallelx: native:* kernels run on the extension thread pool
+--EXTENSIONS--
+parallelx
+--FILE--
+<?php
+require __DIR__ . '/px_test.inc';
+
+px_test_init(1);
+$done = 0;
+$results = [];
+$collect = function(string $key) use (&$results, &$done) {
+    return function($res) use ($key, &$results, &$done) {
+        $results[$key] = $res;
+        $done++;
+    };
+};
+
+$data = str_repeat('parallelx native kernels ', 1000);
+parallelx_submit_desc(['type' => 'native:crc32', 'args' => ['data' => $data]], $collect('crc'));
+parallelx_submit_desc(['type' => 'native:deflate', 'args' => ['data' => $data, 'level' => 6]], $collect('deflate'));
+parallelx_submit_desc(['type' => 'native:f32_affine', 'args' => [
+    'data' => pack('f*', 1.0, 2.0, 3.0, 4.0), 'mul' => 2.0, 'add' => 1.0, 'max' => 8.0,
+]], $collect('affine'));
+parallelx_submit_desc(['type' => 'native:noise2d', 'args' => ['width' => 16, 'height' => 8, 'seed' => 42]], $collect('noise_a'));
+parallelx_submit_desc(['type' => 'native:noise2d', 'args' => ['width' => 16, 'height' => 8, 'seed' => 42]], $collect('noise_b'));
+var_dump(@parallelx_submit_desc(['type' => 'native:nope'], $collect('nope')));
+parallelx_submit_desc(['type' => 'native:f32_affine', 'args' => ['data' => 'abc']], $collect('bad'));
+
+var_dump(px_test_wait($done, 6));
+var_dump($results['crc']['success'], $results['crc']['data'] === crc32($data));
+
+$deflate = $results['deflate'];
+if ($deflate['success']) {
+    var_dump(strlen($deflate['data']) < strlen($data)
+        && (!function_exists('gzinflate') || gzinflate($deflate['data']) === $data));
+} else {
+    var_dump($deflate['data'] === 'zlib support not compiled in');
+}
+
+var_dump(array_values(unpack('f*', $results['affine']['data'])));
+var_dump(strlen($results['noise_a']['data']), $results['noise_a']['data'] === $results['noise_b']['data']);
+$noise = unpack('f*', $results['noise_a']['data']);
+var_dump(min($noise) >= -1.0 && max($noise) <= 1.0);
+
+/* kernelのエラーはsuccess:falseで返るが、タスクとしては完了に数える(worker/forkと同じ) */
+var_dump($results['bad']['success'], $results['bad']['data']);
+$tasks = parallelx_stats()['tasks'];
+var_dump($tasks['completed'], $tasks['failed']);
+parallelx_shutdown();
+?>
+--EXPECT--
+bool(false)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+array(4) {
+  [0]=>
+  float(3)
+  [1]=>
+  float(5)
+  [2]=>
+  float(7)
+  [3]=>
+  float(8)
+}
+int(512)
+bool(true)
+bool(true)
+bool(false)
+string(34) "data length is not a multiple of 4"
+int(6)
+int(0)
@@ -0,0 +1,81 @@
+--TEST--
+parallelx: memoized tokens coalesce in-flight tasks and answer repeats from cache
+--EXTENSIONS--
+parallelx
+--FILE--
+<?php
+require __DIR__ . '/px_test.inc';
+
+px_test_init(2);
+$token = parallelx_register('function($x) { usleep(100000); return [$x * 2, getmypid()]; }');
+var_dump(parallelx_memoize($token, 60000));
+
+$results = [];
+$done = 0;
+$cb = function($res) use (&$results, &$done) {
+    $results[$res['task_id']] = $res['success'] ? px_test_return($res) : null;
+    $done++;
+};
+
+/* 同じ引数の3つは1回だけ実行される */
+parallelx_submit_token($token, [21], $cb);
+parallelx_submit_token($token, [21], $cb);
+parallelx_submit_token($token, [21], $cb);
+parallelx_submit_token($token, [5], $cb);
+var_dump(px_test_wait($done, 4));
+ksort($results);
+var_dump(count($results), count(array_unique(array_map(fn($r) => $r[1], array_slice($results, 0, 3)))));
+var_dump(array_column($results, 0));
+
+/* 2回目はキャッシュから */
+parallelx_submit_token($token, [21], $cb);
+var_dump(parallelx_stats()['queue']['running']);
+var_dump(px_test_wait($done, 5));
+var_dump(end($results)[0]);
+
+/* 失敗は待ち合わせ中のタスクにも配られ、キャッシュされない */
+$fail = parallelx_register('function() { usleep(100000); throw new \RuntimeException("boom"); }');
+parallelx_memoize($fail, 60000);
+parallelx_submit_token($fail, [], $cb);
+parallelx_submit_token($fail, [], $cb);
+var_dump(px_test_wait($done, 7));
+var_dump(array_slice($results, -2));
+
+$memo = parallelx_stats()['memo'];
+var_dump($memo['hits'], $memo['misses'], $memo['coalesced'], $memo['bytes'] > 0);
+
+var_dump(parallelx_memoize('px_tok_missing', 1000));
+parallelx_shutdown();
+?>
+--EXPECTF--
+bool(true)
+bool(true)
+int(4)
+int(1)
+array(4) {
+  [0]=>
+  int(42)
+  [1]=>
+  int(42)
+  [2]=>
+  int(42)
+  [3]=>
+  int(10)
+}
+int(0)
+bool(true)
+int(42)
+bool(true)
+array(2) {
+  [0]=>
+  NULL
+  [1]=>
+  NULL
+}
+int(1)
+int(3)
+int(3)
+bool(true)
+
+Warning: parallelx_memoize(): parallelx_memoize: token not found in %s on line %d
+bool(false)
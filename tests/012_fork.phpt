@@ -0,0 +1,79 @@
+--TEST--
+parallelx: fork mode runs closures against copy-on-write main-process state
+--EXTENSIONS--
+parallelx
+--SKIPIF--
+<?php if (PHP_OS_FAMILY !== 'Linux') die('skip Linux only'); ?>
+--FILE--
+<?php
+require __DIR__ . '/px_test.inc';
+
+px_test_init(1);
+
+$world = [];
+for ($i = 0; $i < 10000; ++$i) $world["k$i"] = $i;
+$parent = getmypid();
+
+$results = [];
+$done = 0;
+$cb = function($res) use (&$results, &$done) {
+    $results[] = $res;
+    $done++;
+};
+
+var_dump(parallelx_submit_fork(function($key) use ($world, $parent) {
+    echo "hello";
+    return [$world[$key], getmypid() !== $parent];
+}, ['k1234'], $cb));
+var_dump(px_test_wait($done, 1));
+$out = unserialize(base64_decode($results[0]['data']));
+var_dump($out['return'], $out['output']);
+
+/* 例外は失敗として返る */
+parallelx_submit_fork(function() { throw new \RuntimeException('boom'); }, [], $cb);
+var_dump(px_test_wait($done, 2));
+var_dump($results[1]['success'], $results[1]['data']);
+
+/* 同時実行数の上限 */
+var_dump(parallelx_fork_limit(1));
+var_dump(parallelx_submit_fork(function() { usleep(200000); return 1; }, [], $cb));
+var_dump(parallelx_submit_fork(function() { return 2; }, [], $cb));
+var_dump(px_test_wait($done, 3));
+var_dump($results[2]['success']);
+
+/* exit() は例外オブジェクトではないので専用の文言で返る */
+parallelx_submit_fork(function() { exit(3); }, [], $cb);
+var_dump(px_test_wait($done, 4));
+var_dump($results[3]['success'], $results[3]['data']);
+
+/* workerと同じく、子が返した success:false も完了として数える */
+$stats = parallelx_stats();
+var_dump($stats['tasks']['submitted'], $stats['tasks']['completed'], $stats['tasks']['failed']);
+parallelx_shutdown();
+?>
+--EXPECTF--
+bool(true)
+bool(true)
+array(2) {
+  [0]=>
+  int(1234)
+  [1]=>
+  bool(true)
+}
+string(5) "hello"
+bool(true)
+bool(false)
+string(15) "exception: boom"
+int(4)
+bool(true)
+
+Warning: parallelx_submit_fork(): parallelx_submit_fork: too many concurrent forks (limit 1) in %s on line %d
+bool(false)
+bool(true)
+bool(true)
+bool(true)
+bool(false)
+string(18) "task called exit()"
+int(4)
+int(4)
+int(0)
@@ -0,0 +1,65 @@
+--TEST--
+parallelx: owner-tagged submits are dispatched by weighted round robin with per-owner in-flight caps
+--EXTENSIONS--
+parallelx
+--FILE--
+<?php
+require __DIR__ . '/px_test.inc';
+
+px_test_init(1);
+$token = parallelx_register('function($o) { usleep(2000); return $o; }');
+var_dump(parallelx_owner_config('b', 2));
+
+$order = [];
+$done = 0;
+$cb = function($res) use (&$order, &$done) {
+    $order[] = px_test_return($res);
+    $done++;
+};
+for ($i = 0; $i < 6; ++$i) parallelx_submit_token($token, ['a'], $cb, ['owner' => 'a']);
+for ($i = 0; $i < 6; ++$i) parallelx_submit_token($token, ['b'], $cb, ['owner' => 'b']);
+var_dump(px_test_wait($done, 12));
+echo implode(' ', $order), "\n";
+
+$owners = parallelx_stats()['owners'];
+var_dump($owners['a']['completed'], $owners['b']['completed'], $owners['b']['weight']);
+var_dump($owners['b']['queue_wait_us']['count']);
+parallelx_shutdown();
+
+/* max_inflight: workerが空いていても上限を超えて投げない */
+px_test_init(2);
+$token = parallelx_register('function() { usleep(50000); return 1; }');
+parallelx_owner_config('cap', 1, 1);
+$done = 0;
+for ($i = 0; $i < 4; ++$i) {
+    parallelx_submit_token($token, [], function() use (&$done) { $done++; }, ['owner' => 'cap']);
+}
+parallelx_submit_token($token, [], function() use (&$done) { $done++; });
+$s = parallelx_stats();
+var_dump($s['owners']['cap']['inflight'], $s['owners']['cap']['depth'], $s['queue']['running']);
+var_dump(px_test_wait($done, 5));
+var_dump(parallelx_stats()['owners']['default']['completed']);
+
+var_dump(parallelx_submit_token($token, [], fn() => null, ['owner' => '']));
+var_dump(parallelx_owner_config('cap', 0));
+parallelx_shutdown();
+?>
+--EXPECTF--
+bool(true)
+bool(true)
+a b b a b b a b b a a a
+int(6)
+int(6)
+int(2)
+int(6)
+int(1)
+int(3)
+int(2)
+bool(true)
+int(1)
+
+Warning: parallelx_submit_token(): parallelx_submit_token: owner must be a non-empty string in %s on line %d
+bool(false)
+
+Warning: parallelx_owner_config(): parallelx_owner_config: weight must be between 1 and 1000 in %s on line %d
+bool(false)
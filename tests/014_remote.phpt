@@ -0,0 +1,82 @@
+--TEST--
+parallelx: remote worker daemon slots over a unix socket, including reconnect after a crash
+--EXTENSIONS--
+parallelx
+--SKIPIF--
+<?php if (PHP_OS_FAMILY === 'Windows') die('skip POSIX only'); ?>
+--FILE--
+<?php
+require __DIR__ . '/px_test.inc';
+
+$sock = sys_get_temp_dir() . '/px_test_' . getmypid() . '.sock';
+$daemon = proc_open([PHP_BINARY, __DIR__ . '/../worker/parallelx_daemon.php', "--listen=unix://$sock", '--slots=2',
+                     '--worker=' . PX_TEST_WORKER], [2 => ['file', '/dev/null', 'w']], $pipes, null,
+                    getenv() + ['PARALLELX_SECRET' => 'px-test-secret']);
+for ($i = 0; $i < 100 && !file_exists($sock); ++$i) usleep(20000);
+
+px_test_init(1);
+/* secretが違う接続にはhelloを返さない */
+var_dump(parallelx_add_remote("unix://$sock", 0, 'wrong'));
+var_dump(parallelx_add_remote("unix://$sock", 0, 'px-test-secret'));
+
+$s = parallelx_stats();
+var_dump(count($s['workers']), $s['workers'][0]['remote'], $s['workers'][1]['remote'] === "unix://$sock");
+
+$token = parallelx_register('function($ms) { usleep($ms * 1000); return getmypid(); }');
+$pids = [];
+$done = 0;
+for ($i = 0; $i < 3; ++$i) {
+    parallelx_submit_token($token, [200], function($res) use (&$pids, &$done) {
+        $pids[] = px_test_return($res);
+        $done++;
+    });
+}
+var_dump(parallelx_stats()['queue']['running']);
+var_dump(px_test_wait($done, 3), count(array_unique($pids)));
+
+/* remote slotのworkerが落ちたら実行中のタスクは失敗し、slotはつなぎ直される */
+$crash = parallelx_register('function() { exit(1); }');
+$results = [];
+$done = 0;
+parallelx_submit_token($token, [300], function($res) use (&$done) { $done++; });
+parallelx_submit_token($crash, [], function($res) use (&$results, &$done) {
+    $results[] = $res;
+    $done++;
+});
+var_dump(px_test_wait($done, 2));
+var_dump($results[0]['success'], $results[0]['data']);
+
+$done = 0;
+for ($i = 0; $i < 3; ++$i) {
+    parallelx_submit_token($token, [0], function($res) use (&$done) { if ($res['success']) $done++; });
+}
+var_dump(px_test_wait($done, 3));
+$s = parallelx_stats();
+var_dump($s['worker_restarts'] >= 1, count($s['workers']));
+
+var_dump(parallelx_add_remote('udp://127.0.0.1:1'));
+parallelx_shutdown();
+
+proc_terminate($daemon);
+proc_close($daemon);
+@unlink($sock);
+?>
+--EXPECTF--
+Warning: parallelx_add_remote(): parallelx_add_remote: connect, auth or hello failed: unix://%s in %s on line %d
+bool(false)
+int(2)
+int(3)
+NULL
+bool(true)
+int(3)
+bool(true)
+int(3)
+bool(true)
+bool(false)
+string(11) "worker died"
+bool(true)
+bool(true)
+int(3)
+
+Warning: parallelx_add_remote(): parallelx_add_remote: address must start with unix:// or tcp:// in %s on line %d
+bool(false)
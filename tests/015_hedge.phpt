@@ -0,0 +1,60 @@
+--TEST--
+parallelx: hedged tasks are duplicated to an idle worker and the first result wins
+--EXTENSIONS--
+parallelx
+--FILE--
+<?php
+require __DIR__ . '/px_test.inc';
+
+px_test_init(2);
+$marker = sys_get_temp_dir() . '/px_hedge_' . getmypid();
+@unlink($marker);
+/* 最初の実行だけ遅い */
+$token = parallelx_register('function($marker) {
+    if (!file_exists($marker)) { touch($marker); usleep(1000000); return "slow"; }
+    return "fast";
+}');
+
+$got = [];
+$done = 0;
+$t0 = microtime(true);
+var_dump(parallelx_submit_token($token, [$marker], function($res) use (&$got, &$done) {
+    $got[] = px_test_return($res);
+    $done++;
+}, ['hedge' => 100]));
+var_dump(px_test_wait($done, 1));
+var_dump($got, microtime(true) - $t0 < 0.9);
+
+/* 負けた側の結果はcallbackにも通知にも出ない */
+$deadline = microtime(true) + 5;
+while (parallelx_stats()['queue']['running'] > 0 && microtime(true) < $deadline) {
+    parallelx_poll();
+    usleep(1000);
+}
+$s = parallelx_stats();
+var_dump(count($got), $s['hedge'], $s['tasks']['completed'], $s['tasks']['callback_not_found']);
+
+var_dump(parallelx_submit_token($token, [$marker], fn() => null, ['hedge' => 'soon']));
+parallelx_shutdown();
+@unlink($marker);
+?>
+--EXPECTF--
+bool(true)
+bool(true)
+array(1) {
+  [0]=>
+  string(4) "fast"
+}
+bool(true)
+int(1)
+array(2) {
+  ["launched"]=>
+  int(1)
+  ["won"]=>
+  int(1)
+}
+int(1)
+int(0)
+
+Warning: parallelx_submit_token(): parallelx_submit_token: hedge must be a positive number of milliseconds or true in %s on line %d
+bool(false)
@@ -0,0 +1,100 @@
+--TEST--
+parallelx: rolling reload keeps running tasks and moves new tasks to the new generation
+--EXTENSIONS--
+parallelx
+--FILE--
+<?php
+require __DIR__ . '/px_test.inc';
+
+px_test_init(2);
+$token = parallelx_register('function($ms) { usleep($ms * 1000); return getmypid(); }');
+
+$old = [];
+$new = [];
+$done = 0;
+/* 旧世代で実行中のタスク */
+for ($i = 0; $i < 2; ++$i) {
+    parallelx_submit_token($token, [300], function($res) use (&$old, &$done) {
+        $old[] = px_test_return($res);
+        $done++;
+    });
+}
+parallelx_poll();
+var_dump(parallelx_reload(['workers' => 2]));
+
+for ($i = 0; $i < 4; ++$i) {
+    parallelx_submit_token($token, [0], function($res) use (&$new, &$done) {
+        $new[] = px_test_return($res);
+        $done++;
+    });
+}
+var_dump(px_test_wait($done, 6));
+var_dump(count($old), count($new), array_intersect($old, $new));
+
+/* 旧世代は手が空いたので退役している */
+$deadline = microtime(true) + 2;
+do {
+    parallelx_poll();
+    $workers = parallelx_stats()['workers'];
+} while (count($workers) > 2 && microtime(true) < $deadline);
+var_dump(count($workers), array_unique(array_column($workers, 'generation')));
+var_dump(parallelx_stats()['tasks']['failed']);
+
+var_dump(parallelx_reload(['worker_script' => '/nonexistent/worker.php']));
+var_dump(parallelx_reload(['php_cli' => '/nonexistent/php']));
+
+/* 起動できても1往復する前に落ちる新しい世代は取り消され、旧世代が使われ続ける。
+ * 新しい世代に送られていたタスクは落とさず旧世代でやり直す */
+$fake = tempnam(sys_get_temp_dir(), 'pxcli');
+file_put_contents($fake, "#!/bin/sh\nexit 1\n");
+chmod($fake, 0755);
+var_dump(parallelx_reload(['php_cli' => $fake]));
+$retried = null;
+parallelx_submit_token($token, [0], function($res) use (&$retried, &$done) {
+    $retried = $res;
+    $done++;
+});
+var_dump(px_test_wait($done, 7));
+var_dump($retried['success'], in_array(px_test_return($retried), $new, true));
+$deadline = microtime(true) + 2;
+do {
+    parallelx_poll();
+    usleep(10000);
+    $workers = parallelx_stats()['workers'];
+} while (count($workers) > 2 && microtime(true) < $deadline);
+var_dump(count($workers), array_unique(array_column($workers, 'generation')));
+var_dump(parallelx_stats()['tasks']['failed']);
+unlink($fake);
+parallelx_shutdown();
+?>
+--EXPECTF--
+bool(true)
+bool(true)
+int(2)
+int(4)
+array(0) {
+}
+int(2)
+array(1) {
+  [0]=>
+  int(1)
+}
+int(0)
+
+Warning: parallelx_reload(): parallelx_reload: worker script '/nonexistent/worker.php' is not readable in %s on line %d
+bool(false)
+
+Warning: parallelx_reload(): parallelx_reload: php_cli '/nonexistent/php' is not executable in %s on line %d
+bool(false)
+bool(true)
+
+Warning: parallelx_poll(): parallelx_reload: new workers exited before completing a task; keeping the previous generation in %s on line %d
+bool(true)
+bool(true)
+bool(true)
+int(2)
+array(1) {
+  [0]=>
+  int(1)
+}
+int(0)
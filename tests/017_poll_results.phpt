@@ -0,0 +1,91 @@
+--TEST--
+parallelx: results without a callback are drained in bulk or delivered to a per-token batch callback
+--EXTENSIONS--
+parallelx
+--FILE--
+<?php
+require __DIR__ . '/px_test.inc';
+
+px_test_init(2);
+$token = parallelx_register('function($n) { return $n * 2; }');
+
+/* callbackなしはtask idが返り、結果は poll_results で受け取る */
+$ids = [];
+for ($i = 1; $i <= 5; ++$i) {
+    $ids[$i] = parallelx_submit_token($token, [$i]);
+}
+var_dump(count(array_filter($ids, 'is_int')));
+var_dump(parallelx_submit_token($token, [0], fn() => null));
+
+$got = [];
+$deadline = microtime(true) + 10;
+while (count($got) < 5 && microtime(true) < $deadline) {
+    foreach (parallelx_poll_results(2) as $tid => $res) {
+        $got[$tid] = px_test_return($res);
+    }
+    usleep(500);
+}
+ksort($got);
+var_dump(array_keys($got) === array_values($ids), array_values($got));
+var_dump(parallelx_poll_results());
+
+/* batch callbackはpollごとに1回、そのpollで届いた分をまとめて受け取る */
+$calls = 0;
+$sum = 0;
+$done = 0;
+var_dump(parallelx_set_batch_callback($token, function(array $batch) use (&$calls, &$sum, &$done) {
+    $calls++;
+    foreach ($batch as $tid => $res) {
+        $sum += px_test_return($res);
+        $done++;
+    }
+}));
+for ($i = 1; $i <= 10; ++$i) {
+    parallelx_submit_token($token, [$i]);
+}
+var_dump(px_test_wait($done, 10));
+var_dump($sum, $calls >= 1 && $calls <= 10, parallelx_stats()['queue']['results_pending']);
+
+/* 外した後は poll_results に戻る */
+var_dump(parallelx_set_batch_callback($token, null));
+$tid = parallelx_submit_token($token, [21]);
+$res = [];
+$deadline = microtime(true) + 10;
+while (!$res && microtime(true) < $deadline) {
+    $res = parallelx_poll_results();
+    usleep(500);
+}
+var_dump(px_test_return($res[$tid]), $calls <= 10);
+
+var_dump(parallelx_set_batch_callback('nope', null));
+parallelx_shutdown();
+?>
+--EXPECTF--
+int(5)
+bool(true)
+bool(true)
+array(5) {
+  [0]=>
+  int(2)
+  [1]=>
+  int(4)
+  [2]=>
+  int(6)
+  [3]=>
+  int(8)
+  [4]=>
+  int(10)
+}
+array(0) {
+}
+bool(true)
+bool(true)
+int(110)
+bool(true)
+int(0)
+bool(true)
+int(42)
+bool(true)
+
+Warning: parallelx_set_batch_callback(): parallelx_set_batch_callback: token not found in %s on line %d
+bool(false)
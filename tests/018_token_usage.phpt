@@ -0,0 +1,48 @@
+--TEST--
+parallelx: workers report wall time, CPU time and peak memory per task, aggregated per token
+--EXTENSIONS--
+parallelx
+--FILE--
+<?php
+require __DIR__ . '/px_test.inc';
+
+px_test_init(2);
+$spin = parallelx_register('function($ms) { $end = microtime(true) + $ms / 1000; $n = 0; while (microtime(true) < $end) $n++; return $n > 0; }');
+$alloc = parallelx_register('function($mb) { $s = str_repeat("x", $mb * 1024 * 1024); return strlen($s); }');
+$idle = parallelx_register('function() { return 1; }');
+
+$done = 0;
+$cb = function($res) use (&$done) { $done++; };
+for ($i = 0; $i < 3; ++$i) {
+    parallelx_submit_token($spin, [50], $cb);
+}
+parallelx_submit_token($alloc, [4], $cb);
+var_dump(px_test_wait($done, 4));
+
+$u = parallelx_token_usage($spin);
+var_dump($u['tasks'], $u['wall_us'] >= 150000, $u['cpu_us'] >= 50000, $u['avg_wall_us'] >= 50000);
+$m = parallelx_token_usage($alloc);
+var_dump($m['tasks'], $m['mem_peak_max'] >= 4 * 1024 * 1024);
+
+$all = parallelx_token_usage();
+var_dump(isset($all[$spin], $all[$alloc]), isset($all[$idle]));
+
+parallelx_token_usage($spin, true);
+var_dump(parallelx_token_usage($spin)['tasks']);
+var_dump(parallelx_token_usage('nope'));
+parallelx_shutdown();
+?>
+--EXPECTF--
+bool(true)
+int(3)
+bool(true)
+bool(true)
+bool(true)
+int(1)
+bool(true)
+bool(true)
+bool(false)
+int(0)
+
+Warning: parallelx_token_usage(): parallelx_token_usage: token not found in %s on line %d
+bool(false)
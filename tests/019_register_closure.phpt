@@ -0,0 +1,83 @@
+--TEST--
+parallelx: parallelx_register_closure extracts source spans and captured variables natively
+--EXTENSIONS--
+parallelx
+--FILE--
+<?php
+require __DIR__ . '/px_test.inc';
+
+px_test_init(2);
+
+/* 同じ行の2つのクロージャは引数名で見分ける */
+$inc = function($x) { return $x + 1; }; $mul = function($y) { return $y * 10; };
+$k = 3;
+$scale = function(int $n) use ($k): int {
+    $s = "}{ ) ("; // 文字列やコメントの括弧は数えない
+    return $n * $k;
+};
+$m = 5;
+$arrow = fn($n) => [$n, $m];
+
+$tokens = [];
+foreach (['inc' => $inc, 'mul' => $mul, 'scale' => $scale, 'arrow' => $arrow] as $name => $c) {
+    $tokens[$name] = parallelx_register_closure($c);
+}
+var_dump(count(array_unique($tokens)), str_starts_with($tokens['inc'], 'px_clo_'));
+
+/* 内容が同じなら同じtoken、捕捉した値が違えば別のtoken */
+var_dump(parallelx_register_closure($scale) === $tokens['scale']);
+$make = fn(int $k) => function(int $n) use ($k): int { return $n * $k; };
+var_dump(parallelx_register_closure($make(2)) === parallelx_register_closure($make(2)));
+var_dump(parallelx_register_closure($make(2)) !== parallelx_register_closure($make(4)));
+
+$got = [];
+$done = 0;
+foreach ($tokens as $name => $token) {
+    parallelx_submit_token($token, [1], function($res) use (&$got, &$done, $name) {
+        $got[$name] = $res['success'] ? px_test_return($res) : $res['data'];
+        $done++;
+    });
+}
+var_dump(px_test_wait($done, 4));
+ksort($got);
+var_dump($got);
+
+$fn = function() use ($inc) { return 1; };
+var_dump(parallelx_register_closure($fn));
+var_dump(parallelx_register_closure(Closure::fromCallable('strlen')));
+/* 引数名も行も同じで区別できないときは推測せずに失敗する */
+$p = fn($x) => $x + 1; $q = fn($x) => $x * 2;
+var_dump(parallelx_register_closure($q));
+parallelx_shutdown();
+?>
+--EXPECTF--
+int(4)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+array(4) {
+  ["arrow"]=>
+  array(2) {
+    [0]=>
+    int(1)
+    [1]=>
+    int(5)
+  }
+  ["inc"]=>
+  int(2)
+  ["mul"]=>
+  int(10)
+  ["scale"]=>
+  int(3)
+}
+
+Warning: parallelx_register_closure(): parallelx_register_closure: captured variables are not serializable in %s on line %d
+bool(false)
+
+Warning: parallelx_register_closure(): parallelx_register_closure: internal functions cannot be registered in %s on line %d
+bool(false)
+
+Warning: parallelx_register_closure(): parallelx_register_closure: ambiguous closure source (several closures with the same parameters on one line) in %s on line %d
+bool(false)
@@ -0,0 +1,151 @@
+<?php
+/*
+ * parallelx remote worker daemon
+ *
+ *   php parallelx_daemon.php --listen=unix:///run/parallelx.sock --slots=4 [--worker=path] [--php=binary] [--autoload=path]
+ *   PARALLELX_SECRET=... php parallelx_daemon.php --listen=tcp://127.0.0.1:7650 --slots=8
+ *   php parallelx_daemon.php --listen=tcp://10.0.0.5:7650 --secret-file=/etc/parallelx.secret --slots=8
+ *
+ * !! 接続してきた相手の任意のPHPコードを実行する。信頼できないネットワークから届く場所で動かさないこと !!
+ * loopback以外のtcpでlistenするときは共有secret(PARALLELX_SECRET か --secret-file)が必須。
+ *
+ * 接続ごとに最初のフレーム {"parallelx":"auth","secret":"..."} を照合し、合っていれば
+ * helloフレーム {"parallelx":"hello","slots":N} を返して、その接続をstdin/stdoutにした
+ * worker scriptを1つ起動する。以降のフレームはworkerとサーバーが直接やりとりする。
+ * 同時に動くworkerは --slots まで。超えた接続には slots=0 を返して閉じる
+ */
+
+declare(strict_types=1);
+
+$opts = getopt('', ['listen:', 'slots:', 'worker:', 'php:', 'autoload:', 'secret-file:']);
+$listen = (string) ($opts['listen'] ?? 'tcp://127.0.0.1:7650');
+$slots = max(1, (int) ($opts['slots'] ?? 4));
+$worker = (string) ($opts['worker'] ?? __DIR__ . '/parallelx_worker.php');
+$php = (string) ($opts['php'] ?? PHP_BINARY);
+
+if (!is_file($worker)) {
+    fwrite(STDERR, "parallelx_daemon: worker script not found: $worker\n");
+    exit(1);
+}
+if (isset($opts['autoload'])) {
+    putenv('PARALLELX_AUTOLOAD=' . $opts['autoload']);
+}
+
+/* secretはpsに出ないよう環境変数かファイルで渡す */
+$secret = (string) getenv('PARALLELX_SECRET');
+if (isset($opts['secret-file'])) {
+    $contents = @file_get_contents((string) $opts['secret-file']);
+    if ($contents === false) {
+        fwrite(STDERR, "parallelx_daemon: cannot read secret file: {$opts['secret-file']}\n");
+        exit(1);
+    }
+    $secret = trim($contents);
+}
+/* workerには渡さない */
+putenv('PARALLELX_SECRET');
+if ($secret === '' && str_starts_with($listen, 'tcp://') &&
+    !preg_match('#^tcp://(127\.[0-9.]+|\[::1\]|localhost):#', $listen)) {
+    fwrite(STDERR, "parallelx_daemon: refusing to listen on $listen without a secret (PARALLELX_SECRET or --secret-file)\n");
+    exit(1);
+}
+
+$unixPath = str_starts_with($listen, 'unix://') ? substr($listen, 7) : null;
+if ($unixPath !== null && file_exists($unixPath)) {
+    unlink($unixPath);
+}
+
+$server = @stream_socket_server($listen, $errno, $errstr);
+if ($server === false) {
+    fwrite(STDERR, "parallelx_daemon: listen $listen failed: $errstr\n");
+    exit(1);
+}
+
+$running = true;
+if (function_exists('pcntl_signal')) {
+    pcntl_async_signals(true);
+    $stop = function() use (&$running) { $running = false; };
+    pcntl_signal(SIGTERM, $stop);
+    pcntl_signal(SIGINT, $stop);
+}
+
+function hello_frame(int $slots): string {
+    $json = json_encode(['parallelx' => 'hello', 'slots' => $slots]);
+    return pack('N', strlen($json)) . $json;
+}
+
+/* 接続直後のauthフレームを読んでsecretを照合する(1秒まで待つ) */
+function check_auth($conn, string $secret): bool {
+    stream_set_timeout($conn, 1);
+    $read = function(int $len) use ($conn): ?string {
+        $buf = '';
+        while (strlen($buf) < $len) {
+            $chunk = fread($conn, $len - strlen($buf));
+            if ($chunk === false || $chunk === '' || stream_get_meta_data($conn)['timed_out']) return null;
+            $buf .= $chunk;
+        }
+        return $buf;
+    };
+    $hdr = $read(4);
+    if ($hdr === null) return false;
+    $len = unpack('N', $hdr)[1];
+    if ($len < 1 || $len > 4096) return false;
+    $body = $read($len);
+    if ($body === null) return false;
+    $auth = json_decode($body, true);
+    return is_array($auth) && ($auth['parallelx'] ?? null) === 'auth' && is_string($auth['secret'] ?? null) &&
+        hash_equals($secret, $auth['secret']);
+}
+
+/** @param resource[] $children */
+function reap(array &$children): void {
+    foreach ($children as $k => $proc) {
+        if (!proc_get_status($proc)['running']) {
+            proc_close($proc);
+            unset($children[$k]);
+        }
+    }
+}
+
+/** @var resource[] $children */
+$children = [];
+fwrite(STDERR, "parallelx_daemon: listening on $listen ($slots slots)\n");
+
+while ($running) {
+    reap($children);
+
+    $read = [$server];
+    $write = $except = null;
+    if (@stream_select($read, $write, $except, 0, 200000) < 1) continue;
+
+    $conn = @stream_socket_accept($server, 0);
+    if ($conn === false) continue;
+    if (!check_auth($conn, $secret)) {
+        fwrite(STDERR, "parallelx_daemon: rejected a connection (bad or missing secret)\n");
+        fclose($conn);
+        continue;
+    }
+
+    /* 落ちたworkerの代わりにすぐ再接続してくるので、数える前にもう一度reapする */
+    reap($children);
+    if (count($children) >= $slots) {
+        @fwrite($conn, hello_frame(0));
+        fclose($conn);
+        continue;
+    }
+    fwrite($conn, hello_frame($slots));
+    $proc = proc_open([$php, $worker], [0 => $conn, 1 => $conn, 2 => STDERR], $pipes);
+    /* ソケットはworkerが持つ。daemon側のコピーは閉じてworker終了時に接続が切れるようにする */
+    fclose($conn);
+    if (is_resource($proc)) {
+        $children[] = $proc;
+    }
+}
+
+foreach ($children as $proc) {
+    proc_terminate($proc);
+    proc_close($proc);
+}
+fclose($server);
+if ($unixPath !== null && file_exists($unixPath)) {
+    unlink($unixPath);
+}
@@ -8,6 +8,7 @@ use ReflectionFunction;
 /**
  * クロージャをSerializableな文字列とSerializeされたバインド変数として抽出
  * Returns ['source' => string (e.g. 'function($a,$b) use($x){...}'), 'bound_b64' => base64(serialized array)].
+ * 登録するだけなら parallelx_register_closure() のほうが速い(ファイルを毎回読まない)
  */
 function extract_closure_descriptor(\Closure $c): array {
     $rf = new ReflectionFunction($c);
@@ -32,3 +33,46 @@ function extract_closure_descriptor(\Closure $c): array {
 
     return ['source' => $source, 'bound_b64' => $bound_b64];
 }
+
+/**
+ * parallelx_shm_allocで確保した共有バッファへworker側から直接書き込む
+ * $bytes はマシンバイトオーダーでpack済みの値、$offset は要素単位
+ * 開けない・書き切れないときは RuntimeException(タスクは success:false で返る)
+ */
+function shm_write(array $handle, string $bytes, int $offset = 0): void {
+    $elem = (int) $handle['elem_size'];
+    if ($offset < 0 || $offset * $elem + strlen($bytes) > $handle['length'] * $elem) {
+        throw new \RangeException("parallelx_helper: write exceeds shared buffer bounds");
+    }
+    $fp = @fopen($handle['path'], 'r+b');
+    if ($fp === false) {
+        throw new \RuntimeException("parallelx_helper: cannot open shared buffer: {$handle['path']}");
+    }
+    try {
+        if (fseek($fp, $offset * $elem) !== 0) {
+            throw new \RuntimeException("parallelx_helper: cannot seek shared buffer: {$handle['path']}");
+        }
+        /* /dev/shmが溢れると途中までしか書けないことがある。半端なバッファを成功として返さない */
+        $written = fwrite($fp, $bytes);
+        if ($written !== strlen($bytes) || !fflush($fp)) {
+            throw new \RuntimeException(sprintf("parallelx_helper: short write to shared buffer %s (%d of %d bytes)",
+                $handle['path'], $written === false ? 0 : $written, strlen($bytes)));
+        }
+    } finally {
+        fclose($fp);
+    }
+}
+
+/**
+ * 数値配列をバッファの型でpackして書き込む
+ */
+function shm_store(array $handle, array $values, int $offset = 0): void {
+    $format = match ($handle['type']) {
+        'int8' => 'c*',
+        'uint8' => 'C*',
+        'int32' => 'l*',
+        'float' => 'f*',
+        default => throw new \InvalidArgumentException("parallelx_helper: unknown buffer type {$handle['type']}"),
+    };
+    shm_write($handle, pack($format, ...$values), $offset);
+}
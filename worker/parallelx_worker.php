@@ -5,6 +5,11 @@ if ($autoload !== false && file_exists($autoload)) {
     @require_once $autoload;
 }
 
+/* getrusage() の utime / stime をマイクロ秒で */
+function parallelx_cpu_us(array $ru, string $kind): int {
+    return $ru["ru_{$kind}.tv_sec"] * 1000000 + $ru["ru_{$kind}.tv_usec"];
+}
+
 while (!feof(STDIN)) {
     $len_bytes = fread(STDIN, 4);
     if ($len_bytes === false || strlen($len_bytes) < 4) break;
@@ -24,6 +29,10 @@ while (!feof(STDIN)) {
         $out = ['task_id'=>0, 'success'=>false, 'data'=>'invalid descriptor'];
     } else {
         $tid = $desc['task_id'] ?? 0;
+        $t_start = microtime(true);
+        $ru_start = getrusage();
+        if (function_exists('memory_reset_peak_usage')) memory_reset_peak_usage();
+        $mem_start = memory_get_usage();
         try {
             if (($desc['type'] ?? '') === 'closure_exec') {
                 $src = $desc['source'] ?? '';
@@ -49,6 +58,18 @@ while (!feof(STDIN)) {
         } catch (Throwable $e) {
             $out = ['task_id'=>$tid,'success'=>false,'data'=>'exception: '.$e->getMessage()];
         }
+        /* wall / user / sys (us) と ピークメモリの増分 (bytes) */
+        $ru_end = getrusage();
+        $out['ru'] = [
+            (int) ((microtime(true) - $t_start) * 1000000),
+            parallelx_cpu_us($ru_end, 'utime') - parallelx_cpu_us($ru_start, 'utime'),
+            parallelx_cpu_us($ru_end, 'stime') - parallelx_cpu_us($ru_start, 'stime'),
+            max(0, memory_get_peak_usage() - $mem_start),
+        ];
+        if (!empty($desc['trace'])) {
+            $out['t_start'] = $t_start;
+            $out['t_end'] = microtime(true);
+        }
     }
     $json = json_encode($out);
     $len2 = strlen($json);